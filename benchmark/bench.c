@@ -13,12 +13,6 @@
 #define STR_HELPER(x) #x
 #define STR(x) STR_HELPER(x)
 
-#ifndef ALLOCATOR
-#define ALLOCATOR dmalloc
-#endif
-#ifndef DEALLOCATOR
-#define DEALLOCATOR dfree
-#endif
 #ifndef NAME
 #define NAME STR(ALLOCATOR)
 #endif
@@ -30,12 +24,38 @@ typedef void (*BenchmarkFunc)(void *(*allocator)(size_t),
                                          unsigned int seed);
 
 int main(int argc, char **argv) {
+  // With --tlb the dTLB misses of the benchmark are counted and printed along
+  // with how much memory is backed by huge pages. With --latency every
+  // allocation and free is timed and percentiles of their latencies are
+  // printed, with --csv as rows of comma separated values
+  bool report_tlb = false;
+  bool report_latency = false;
+  bool csv = false;
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--tlb") == 0) {
+      report_tlb = true;
+    } else if (strcmp(argv[1], "--latency") == 0) {
+      report_latency = true;
+    } else if (strcmp(argv[1], "--csv") == 0) {
+      report_latency = true;
+      csv = true;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+      return 1;
+    }
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+  bool count_tlb_misses = report_tlb;
+
   if (argc < 2) {
     fprintf(stderr,
-            "Usage: %s <benchmark_name> [amount] [size] [seed] [name]\n",
+            "Usage: %s [--tlb] [--latency] [--csv] <benchmark_name> [amount] [size] [seed] [name]\n",
             argv[0]);
-    fprintf(stderr, "Available benchmarks: basic, sporadic, varying, tree, genetic\n");
-    fprintf(stderr, "For genetic: amount=generations, size=population_size\n");
+    fprintf(stderr, "Available benchmarks: basic, sporadic, varying, tree, genetic, genetic_arena, classes, thrash\n");
+    fprintf(stderr, "For genetic and genetic_arena: amount=generations, size=population_size\n");
+    fprintf(stderr, "For varying: size=largest allocation\n");
     return 1;
   }
 
@@ -57,15 +77,45 @@ int main(int argc, char **argv) {
     benchmark_fn = tree_allocs;
   } else if (strcmp(benchmark_name, "genetic") == 0) {
     benchmark_fn = (BenchmarkFunc)genetic_program;
+  } else if (strcmp(benchmark_name, "genetic_arena") == 0) {
+    benchmark_fn = (BenchmarkFunc)genetic_program_arena;
+  } else if (strcmp(benchmark_name, "classes") == 0) {
+    benchmark_fn = size_classes;
+  } else if (strcmp(benchmark_name, "thrash") == 0) {
+    benchmark_fn = boundary_thrash;
   } else {
     fprintf(stderr, "Unknown benchmark: %s\n", benchmark_name);
-    fprintf(stderr, "Available benchmarks: basic, sporadic, varying, tree, genetic\n");
+    fprintf(stderr, "Available benchmarks: basic, sporadic, varying, tree, genetic, genetic_arena, classes, thrash\n");
     return 1;
   }
 
+  if (count_tlb_misses && !start_tlb_miss_counter()) {
+    fprintf(stderr, "dTLB misses can not be counted on this system\n");
+    count_tlb_misses = false;
+  }
+
+  void *(*allocator)(size_t) = ALLOCATOR;
+  void (*deallocator)(void *) = DEALLOCATOR;
+  if (report_latency) {
+    start_latency_timing(allocator, deallocator);
+    allocator = timed_alloc;
+    deallocator = timed_free;
+  }
+
   printf("Start bench\n");
-  benchmark_fn(ALLOCATOR, DEALLOCATOR, amount, size, seed);
+  benchmark_fn(allocator, deallocator, amount, size, seed);
   printf("End bench\n");
 
+  if (report_latency) {
+    print_latencies(stdout, benchmark_name, name, size, csv);
+  }
+
+  if (count_tlb_misses) {
+    printf("dTLB load misses: %lld\n", stop_tlb_miss_counter());
+  }
+  if (report_tlb) {
+    printf("Huge page memory: %lld bytes\n", huge_page_memory());
+  }
+
   return 0;
 }
@@ -1,7 +1,17 @@
 #ifndef BENCHMARK_H
 #define BENCHMARK_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+
+// The allocator that is benchmarked, chosen at compile time
+#ifndef ALLOCATOR
+#define ALLOCATOR dmalloc
+#endif
+#ifndef DEALLOCATOR
+#define DEALLOCATOR dfree
+#endif
 
 // Allocates the amount of objects specified, then deallocates them, then
 // reallocates them and then deallocates them
@@ -13,7 +23,8 @@ void basic_allocs(void *(*allocator)(size_t), void (*deallocator)(void *),
 void sporadic_allocs(void *(*allocator)(size_t), void (*deallocator)(void *),
                      size_t amount, size_t alloc_size, unsigned int seed);
 
-// Does varying allocations of varying sizes
+// Does varying allocations of varying sizes up to size bytes or most of a page
+// if size is 1
 void varying_allocs(void *(*allocator)(size_t), void (*deallocator)(void *),
                     size_t amount, size_t size, unsigned int seed);
 
@@ -24,4 +35,50 @@ void tree_allocs(void *(*allocator)(size_t), void (*deallocator)(void *),
 // Genetic programming benchmark that evolves mathematical expressions
 void genetic_program(void *(*allocator)(size_t), void (*deallocator)(void *),
                      size_t generations, size_t pop_size, unsigned int seed);
+
+// The genetic programming benchmark with the nodes of every generation
+// allocated from an arena that is reset instead of freeing every node
+void genetic_program_arena(void *(*allocator)(size_t),
+                           void (*deallocator)(void *), size_t generations,
+                           size_t pop_size, unsigned int seed);
+
+// Allocates and frees the amount of objects specified for every bin size
+// class and prints the time taken per allocation and free
+void size_classes(void *(*allocator)(size_t), void (*deallocator)(void *),
+                  size_t amount, size_t alloc_size, unsigned int seed);
+
+// Allocates and frees bursts of objects the amount of times specified and
+// then allocates and frees a single object that needs a new region of memory
+// a hundred times as often
+void boundary_thrash(void *(*allocator)(size_t), void (*deallocator)(void *),
+                     size_t amount, size_t alloc_size, unsigned int seed);
+
+// Starts counting the dTLB load misses of the process. Returns false if the
+// os does not allow it, for example without a hardware performance counter
+bool start_tlb_miss_counter();
+
+// Stops counting the dTLB load misses and returns how many there were or -1
+// if they could not be counted
+long long stop_tlb_miss_counter();
+
+// Gets the number of bytes of the process backed by transparent huge pages
+// or -1 if it is not known
+long long huge_page_memory();
+
+// Starts timing every call made through timed_alloc and timed_free, which
+// call allocator and deallocator
+void start_latency_timing(void *(*allocator)(size_t),
+                          void (*deallocator)(void *));
+
+// Allocates and frees memory like the allocator and deallocator passed to
+// start_latency_timing and records how long they took
+void *timed_alloc(size_t size);
+void timed_free(void *ptr);
+
+// Prints the number of allocations and frees, their throughput and the 50th,
+// 99th and 99.9th percentile and maximum of their latencies in nanoseconds.
+// With csv every kind of operation is printed as a row of
+// name,benchmark,size,operation,count,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns
+void print_latencies(FILE *stream, const char *benchmark, const char *name,
+                     size_t size, bool csv);
 #endif
@@ -0,0 +1,73 @@
+#include "../src/allocator.h"
+#include "../src/stats.h"
+#include "benchmark.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// The number of objects allocated and freed together in every burst
+#define BURST_SIZE 4096
+
+// The number of objects kept alive for allocators other than dmalloc, whose
+// regions can not be seen from outside
+#define FALLBACK_LIVE 1000
+
+// Gets the number of bins dmalloc has set up
+static size_t live_bins() {
+  DmallocStats stats;
+  dmalloc_stats(&stats);
+  return stats.bins.live_regions;
+}
+
+void boundary_thrash(void *(*allocator)(size_t), void (*deallocator)(void *),
+                     size_t amount, size_t alloc_size, unsigned int seed) {
+  (void)seed;
+
+  void **allocations = malloc((BURST_SIZE + 1) * sizeof(void *));
+  if (!allocations) {
+    fprintf(stderr, "Memory allocation for benchmark failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Bursts of allocations that are all freed again need more memory than an
+  // allocator keeps around, which is then given back and requested again
+  for (size_t round = 0; round < amount; round++) {
+    for (size_t i = 0; i < BURST_SIZE; i++) {
+      allocations[i] = allocator(alloc_size);
+    }
+    for (size_t i = 0; i < BURST_SIZE; i++) {
+      deallocator(allocations[i]);
+    }
+  }
+
+  // Objects are allocated until one needs a new bin. Without it the bins
+  // holding the objects are full. Other allocators get a fixed number of
+  // objects, which may or may not end on the boundary of one of their regions.
+  // The allocator passed in can be wrapped, for example to time it, so the
+  // one the benchmark was built with decides
+  size_t live = 0;
+  if (ALLOCATOR == dmalloc) {
+    size_t bins = live_bins();
+    while (live < BURST_SIZE) {
+      allocations[live++] = allocator(alloc_size);
+      if (live_bins() != bins) {
+        break;
+      }
+    }
+  } else {
+    while (live < FALLBACK_LIVE + 1) {
+      allocations[live++] = allocator(alloc_size);
+    }
+  }
+  deallocator(allocations[--live]);
+
+  // A single object going back and forth then crosses the boundary of a
+  // region every time
+  for (size_t i = 0; i < amount * 100; i++) {
+    deallocator(allocator(alloc_size));
+  }
+
+  for (size_t i = 0; i < live; i++) {
+    deallocator(allocations[i]);
+  }
+  free(allocations);
+}
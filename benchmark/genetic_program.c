@@ -1,4 +1,6 @@
+#include "../src/arena.h"
 #include "benchmark.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -35,6 +37,20 @@ typedef struct {
 static void *(*g_allocator)(size_t) = NULL;
 static void (*g_deallocator)(void *) = NULL;
 
+// The arena nodes are allocated from when arenas are used. Every generation
+// gets its own arena which is reset once the generation is replaced
+static DArena *g_arena = NULL;
+
+// Allocates a node from the arena of the current generation
+static void *arena_allocator(size_t size) {
+    return darena_alloc(g_arena, size);
+}
+
+// Nodes in an arena are freed when their generation is reset
+static void arena_deallocator(void *ptr) {
+    (void)ptr;
+}
+
 // Target function: f(x) = x^2 + 2*x + 1
 static double target_function(double x) {
     return x * x + 2 * x + 1;
@@ -205,11 +221,18 @@ static void mutate(Node *node, double mutation_rate) {
     mutate(node->right, mutation_rate);
 }
 
-// Main genetic programming function
-void genetic_program(void *(*allocator)(size_t), void (*deallocator)(void *),
-                     size_t generations, size_t pop_size, unsigned int seed) {
-    g_allocator = allocator;
-    g_deallocator = deallocator;
+// Evolves the population. The populations are always allocated with
+// allocator, the nodes are allocated from two arenas that take turns holding
+// the current generation if arenas is not NULL
+static void evolve(void *(*allocator)(size_t), void (*deallocator)(void *),
+                   size_t generations, size_t pop_size, unsigned int seed,
+                   DArena **arenas) {
+    bool use_arenas = arenas != NULL;
+    g_allocator = use_arenas ? arena_allocator : allocator;
+    g_deallocator = use_arenas ? arena_deallocator : deallocator;
+    if (use_arenas) {
+        g_arena = arenas[0];
+    }
     
     srand(seed);
     
@@ -260,6 +283,9 @@ void genetic_program(void *(*allocator)(size_t), void (*deallocator)(void *),
         }
         
         // Create new population
+        if (use_arenas) {
+            g_arena = arenas[(gen + 1) % 2];
+        }
         for (size_t i = 0; i < pop_size; i++) {
             if (i == 0) {
                 // Elitism: keep best individual
@@ -280,8 +306,12 @@ void genetic_program(void *(*allocator)(size_t), void (*deallocator)(void *),
         }
         
         // Free old population trees
-        for (size_t i = 0; i < pop_size; i++) {
-            free_tree(population[i].tree);
+        if (use_arenas) {
+            darena_reset(arenas[gen % 2]);
+        } else {
+            for (size_t i = 0; i < pop_size; i++) {
+                free_tree(population[i].tree);
+            }
         }
         
         // Swap populations
@@ -308,3 +338,24 @@ void genetic_program(void *(*allocator)(size_t), void (*deallocator)(void *),
     deallocator(population);
     deallocator(new_population);
 }
+
+// Main genetic programming function
+void genetic_program(void *(*allocator)(size_t), void (*deallocator)(void *),
+                     size_t generations, size_t pop_size, unsigned int seed) {
+    evolve(allocator, deallocator, generations, pop_size, seed, NULL);
+}
+
+void genetic_program_arena(void *(*allocator)(size_t),
+                           void (*deallocator)(void *), size_t generations,
+                           size_t pop_size, unsigned int seed) {
+    DArena *arenas[2] = {darena_create(), darena_create()};
+    if (!arenas[0] || !arenas[1]) {
+        printf("Failed to create arenas\n");
+        return;
+    }
+
+    evolve(allocator, deallocator, generations, pop_size, seed, arenas);
+
+    darena_destroy(arenas[0]);
+    darena_destroy(arenas[1]);
+}
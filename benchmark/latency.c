@@ -0,0 +1,184 @@
+#include "benchmark.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC
+#endif
+
+// Latencies are kept in a histogram like HdrHistogram: every power of 2 of
+// nanoseconds is split into 2^SUB_BUCKET_BITS buckets so the value of any
+// bucket is known to within about 3% however long the operation took
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_MAGNITUDE 40
+#define NUM_BUCKETS ((MAX_MAGNITUDE + 1) * SUB_BUCKETS)
+
+// The latencies of one kind of operation
+typedef struct {
+  size_t counts[NUM_BUCKETS];
+  size_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} Histogram;
+
+static Histogram alloc_histogram;
+static Histogram free_histogram;
+
+// The allocator and deallocator that are timed
+static void *(*timed_allocator)(size_t);
+static void (*timed_deallocator)(void *);
+
+// The number of nanoseconds per tick of the timestamp counter
+static double ns_per_tick = 1;
+
+// Gets the current time in nanoseconds
+static uint64_t clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Reads the timer, which is the timestamp counter where there is one since
+// it is much cheaper to read than the clock
+static inline uint64_t read_timer() {
+#ifdef HAS_TSC
+  return __rdtsc();
+#else
+  return clock_ns();
+#endif
+}
+
+// Converts a difference of the timer to nanoseconds
+static inline uint64_t timer_ns(uint64_t start, uint64_t end) {
+  return (uint64_t)((end - start) * ns_per_tick);
+}
+
+// Calculates the bucket of a latency
+static inline size_t bucket_index(uint64_t ns) {
+  if (ns < SUB_BUCKETS) {
+    return ns;
+  }
+
+  size_t magnitude = 63 - __builtin_clzll(ns) - SUB_BUCKET_BITS + 1;
+  if (magnitude > MAX_MAGNITUDE) {
+    return NUM_BUCKETS - 1;
+  }
+  size_t sub_bucket = (ns >> (magnitude - 1)) - SUB_BUCKETS;
+  return magnitude * SUB_BUCKETS + sub_bucket;
+}
+
+// Calculates the largest latency that falls in a bucket
+static inline uint64_t bucket_value(size_t index) {
+  size_t magnitude = index / SUB_BUCKETS;
+  size_t sub_bucket = index % SUB_BUCKETS;
+  if (magnitude == 0) {
+    return sub_bucket;
+  }
+
+  return ((uint64_t)(SUB_BUCKETS + sub_bucket + 1) << (magnitude - 1)) - 1;
+}
+
+static inline void record(Histogram *histogram, uint64_t ns) {
+  histogram->counts[bucket_index(ns)]++;
+  histogram->count++;
+  histogram->total_ns += ns;
+  if (ns > histogram->max_ns) {
+    histogram->max_ns = ns;
+  }
+}
+
+// Calculates the latency that the fraction of operations took at most
+static uint64_t percentile(const Histogram *histogram, double fraction) {
+  size_t target = (size_t)(histogram->count * fraction + 0.5);
+  if (target == 0) {
+    target = 1;
+  }
+
+  size_t seen = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= target) {
+      uint64_t value = bucket_value(i);
+      return value < histogram->max_ns ? value : histogram->max_ns;
+    }
+  }
+
+  return histogram->max_ns;
+}
+
+void *timed_alloc(size_t size) {
+  uint64_t start = read_timer();
+  void *ptr = timed_allocator(size);
+  uint64_t end = read_timer();
+
+  record(&alloc_histogram, timer_ns(start, end));
+  return ptr;
+}
+
+void timed_free(void *ptr) {
+  uint64_t start = read_timer();
+  timed_deallocator(ptr);
+  uint64_t end = read_timer();
+
+  record(&free_histogram, timer_ns(start, end));
+}
+
+void start_latency_timing(void *(*allocator)(size_t),
+                          void (*deallocator)(void *)) {
+  timed_allocator = allocator;
+  timed_deallocator = deallocator;
+
+#ifdef HAS_TSC
+  // the rate of the timestamp counter is measured against the clock
+  uint64_t start_ns = clock_ns();
+  uint64_t start_ticks = __rdtsc();
+  while (clock_ns() - start_ns < 20000000) {
+  }
+  uint64_t end_ticks = __rdtsc();
+  uint64_t end_ns = clock_ns();
+  ns_per_tick = (double)(end_ns - start_ns) / (end_ticks - start_ticks);
+#endif
+}
+
+// Prints the latencies of one kind of operation
+static void print_histogram(FILE *stream, const Histogram *histogram,
+                            const char *operation, const char *benchmark,
+                            const char *name, size_t size, bool csv) {
+  if (histogram->count == 0) {
+    return;
+  }
+
+  // the throughput of the operations themselves, without the work the
+  // benchmark does in between
+  double ops_per_sec = histogram->total_ns == 0
+                           ? 0
+                           : histogram->count * 1e9 / histogram->total_ns;
+
+  if (csv) {
+    fprintf(stream, "%s,%s,%zu,%s,%zu,%.0f,%llu,%llu,%llu,%llu\n", name,
+            benchmark, size, operation, histogram->count, ops_per_sec,
+            (unsigned long long)percentile(histogram, 0.5),
+            (unsigned long long)percentile(histogram, 0.99),
+            (unsigned long long)percentile(histogram, 0.999),
+            (unsigned long long)histogram->max_ns);
+  } else {
+    fprintf(stream,
+            "%-6s %10zu ops  %8.2f Mops/s  p50 %6llu ns  p99 %6llu ns  "
+            "p99.9 %6llu ns  max %8llu ns\n",
+            operation, histogram->count, ops_per_sec / 1e6,
+            (unsigned long long)percentile(histogram, 0.5),
+            (unsigned long long)percentile(histogram, 0.99),
+            (unsigned long long)percentile(histogram, 0.999),
+            (unsigned long long)histogram->max_ns);
+  }
+}
+
+void print_latencies(FILE *stream, const char *benchmark, const char *name,
+                     size_t size, bool csv) {
+  print_histogram(stream, &alloc_histogram, "alloc", benchmark, name, size,
+                  csv);
+  print_histogram(stream, &free_histogram, "free", benchmark, name, size, csv);
+}
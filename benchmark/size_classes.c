@@ -0,0 +1,75 @@
+#include "../src/bin.h"
+#include "benchmark.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The number of times the allocations of a size class are repeated
+#define ROUNDS 4
+
+// Gets the current time in nanoseconds
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void size_classes(void *(*allocator)(size_t), void (*deallocator)(void *),
+                  size_t amount, size_t alloc_size, unsigned int seed) {
+  (void)alloc_size;
+
+  void **allocations = malloc(amount * sizeof(void *));
+  size_t *order = malloc(amount * sizeof(size_t));
+  if (!allocations || !order) {
+    fprintf(stderr, "Memory allocation for benchmark failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  srand(seed); // Set seed for reproducibility
+
+  // The same random order is used for freeing every size class
+  for (size_t i = 0; i < amount; i++) {
+    order[i] = i;
+  }
+  for (size_t i = 0; i + 1 < amount; i++) {
+    size_t j = i + rand() % (amount - i);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  printf("size,ns_per_pair\n");
+  for (size_t index = 0; index < NUM_BINS; index++) {
+    size_t size = BIN_CLASS_SIZE(index);
+
+    // Every allocation is written to like a program would, otherwise an
+    // allocator that never touches its blocks would not pay for page faults
+    double start = now_ns();
+    for (size_t round = 0; round < ROUNDS; round++) {
+      for (size_t i = 0; i < amount; i++) {
+        allocations[i] = allocator(size);
+        *(char *)allocations[i] = 1;
+      }
+
+      // Half is freed in a random order and allocated again so that freed
+      // blocks are reused from all over the bins
+      for (size_t i = 0; i < amount / 2; i++) {
+        deallocator(allocations[order[i]]);
+      }
+      for (size_t i = 0; i < amount / 2; i++) {
+        allocations[order[i]] = allocator(size);
+        *(char *)allocations[order[i]] = 1;
+      }
+
+      for (size_t i = 0; i < amount; i++) {
+        deallocator(allocations[order[i]]);
+      }
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%zu,%.2f\n", size, elapsed / (ROUNDS * amount * 3 / 2));
+  }
+
+  free(allocations);
+  free(order);
+}
@@ -0,0 +1,67 @@
+#include "benchmark.h"
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The file descriptor of the counter or -1 if it could not be opened
+static int counter_fd = -1;
+
+bool start_tlb_miss_counter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  // only the misses of the benchmark itself are counted
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  counter_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (counter_fd < 0) {
+    return false;
+  }
+
+  ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+  return true;
+}
+
+long long stop_tlb_miss_counter() {
+  if (counter_fd < 0) {
+    return -1;
+  }
+
+  ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  uint64_t misses;
+  ssize_t bytes_read = read(counter_fd, &misses, sizeof(misses));
+  close(counter_fd);
+  counter_fd = -1;
+
+  return bytes_read == sizeof(misses) ? (long long)misses : -1;
+}
+
+long long huge_page_memory() {
+  FILE *file = fopen("/proc/self/smaps_rollup", "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  long long kilobytes = -1;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "AnonHugePages: %lld kB", &kilobytes) == 1) {
+      break;
+    }
+  }
+  fclose(file);
+
+  return kilobytes < 0 ? -1 : kilobytes * 1024;
+}
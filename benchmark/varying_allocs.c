@@ -13,9 +13,12 @@ void varying_allocs(void *(*allocator)(size_t), void (*deallocator)(void *),
 
   srand(seed); // Set seed for reproducibility
 
+  // The largest allocation to make, by default allocations span most of a page
+  size_t max_size = alloc_size > 1 ? alloc_size : 4081;
+
   // Allocate varying sizes
   for (size_t i = 0; i < amount; ++i) {
-    size_t size = 1 + rand() % 4081; // [1, 4096]
+    size_t size = 1 + rand() % max_size; // [1, max_size]
     sizes[i] = size;
     allocations[i] = allocator(size);
     if (!allocations[i]) {
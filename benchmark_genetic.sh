@@ -4,9 +4,11 @@
 # All executables compiled as "bench", benchmarked immediately, then replaced
 
 # Define allocator-deallocator pairs
-# Format: allocator:deallocator:define_only_small_flag
+# Format: allocator:deallocator:mode where mode is no, yes (ONLY_SMALL defined)
+# or arena (nodes are allocated from dmalloc arenas)
 ALLOCATOR_PAIRS=(
   "dmalloc:dfree:no"
+  "dmalloc:dfree:arena"
   "malloc:free:no"
   # "dmalloc:dfree:yes"
 )
@@ -37,9 +39,13 @@ for PAIR in "${ALLOCATOR_PAIRS[@]}"; do
 
   EXTRA_FLAGS=""
   LABEL="$ALLOCATOR"
+  BENCHMARK="genetic"
   if [[ "$DEFINE_ONLY_SMALL" == "yes" ]]; then
     EXTRA_FLAGS="-DONLY_SMALL"
     LABEL="${ALLOCATOR}_onlysmall"
+  elif [[ "$DEFINE_ONLY_SMALL" == "arena" ]]; then
+    LABEL="${ALLOCATOR}_arena"
+    BENCHMARK="genetic_arena"
   fi
 
   echo ""
@@ -62,7 +68,7 @@ for PAIR in "${ALLOCATOR_PAIRS[@]}"; do
     echo "🧪 Running test '$TEST_NAME' ($GENERATIONS generations, $POPULATION individuals) with $LABEL"
     echo "------------------------------------------------------------"
 
-    CMD="./bench genetic $GENERATIONS $POPULATION $SEED"
+    CMD="./bench $BENCHMARK $GENERATIONS $POPULATION $SEED"
 
     # Run benchmark with hyperfine, export results to unique CSV per allocator and test
     hyperfine --warmup 1 --export-csv "./results/genetic/genetic_${TEST_NAME}_${LABEL}.csv" --runs 10 -N "$CMD"
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Define allocator-deallocator pairs
+# Format: allocator:deallocator
+ALLOCATOR_PAIRS=(
+  "dmalloc:dfree"    # Pure dmalloc
+  "malloc:free"      # Pure malloc
+)
+
+# Define benchmark types
+BENCHMARKS=("basic" "sporadic" "varying")
+
+# Allocation sizes to test (in bytes)
+SIZES=(16 64 256 1024 2048)
+
+# Largest allocation sizes for the varying benchmark
+VARYING_SIZES=(128 1024 4081)
+
+# Accept the number of allocations from CLI or default to 100000
+AMOUNT=${1:-100000}
+
+# Create output directory
+mkdir -p ./results
+
+# Every allocation and free is timed inside the benchmark so the latencies do
+# not include starting the process
+OUTPUT="./results/latency.csv"
+echo "name,benchmark,size,operation,count,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns" > "$OUTPUT"
+
+# Loop through allocator configurations
+for PAIR in "${ALLOCATOR_PAIRS[@]}"; do
+  IFS=":" read -r ALLOCATOR DEALLOCATOR <<< "$PAIR"
+
+  echo "🔨 Compiling with ALLOCATOR=$ALLOCATOR, DEALLOCATOR=$DEALLOCATOR"
+
+  clang -O3 \
+    -DALLOCATOR="$ALLOCATOR" \
+    -DDEALLOCATOR="$DEALLOCATOR" \
+    -o ./bench \
+    src/*.c benchmark/*.c
+
+  if [[ $? -ne 0 ]]; then
+    echo "❌ Compilation failed for $ALLOCATOR and $DEALLOCATOR"
+    continue
+  fi
+
+  # Loop through benchmarks
+  for BENCHMARK in "${BENCHMARKS[@]}"; do
+    if [[ "$BENCHMARK" == "varying" ]]; then
+      BENCHMARK_SIZES=("${VARYING_SIZES[@]}")
+    else
+      BENCHMARK_SIZES=("${SIZES[@]}")
+    fi
+
+    for SIZE in "${BENCHMARK_SIZES[@]}"; do
+      echo "🚀 Benchmarking ${BENCHMARK}_${ALLOCATOR}_size${SIZE}"
+      ./bench --csv "$BENCHMARK" "$AMOUNT" "$SIZE" | grep "^${ALLOCATOR}," >> "$OUTPUT"
+    done
+  done
+done
+
+echo "✅ Latencies written to $OUTPUT"
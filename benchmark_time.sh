@@ -1,11 +1,13 @@
 #!/bin/bash
 
 # Define allocator-deallocator pairs
-# Format: allocator:deallocator:define_only_small_flag
+# Format: allocator:deallocator:mode where mode is no, yes (ONLY_SMALL defined)
+# or freelist (BIN_FREE_LIST defined)
 ALLOCATOR_PAIRS=(
   "dmalloc:dfree:no"    # Pure dmalloc
   "malloc:free:no"      # Pure malloc
   # "dmalloc:dfree:yes"   # Hybrid mode (ONLY_SMALL defined)
+  # "dmalloc:dfree:freelist" # Bins with free lists instead of bitsets
 )
 
 # Define benchmark types
@@ -14,6 +16,10 @@ BENCHMARKS=("basic" "sporadic" "varying")
 # Allocation sizes to test (in bytes)
 SIZES=(1 2 4 8 16 32 64 128 256 512 1024 2048)
 
+# Largest allocation sizes for the varying benchmark, this shows the cost of
+# moving from the bins to the free list and huge allocators
+VARYING_SIZES=(128 256 512 1024 2048 4081)
+
 # Accept total allocation count from CLI or default to 10000
 TOTAL_AMOUNT=${1:-10000}
 NUM_STEPS=10
@@ -38,6 +44,9 @@ for PAIR in "${ALLOCATOR_PAIRS[@]}"; do
   if [[ "$DEFINE_ONLY_SMALL" == "yes" ]]; then
     EXTRA_FLAGS="-DONLY_SMALL"
     MODE_SUFFIX="_onlysmall"
+  elif [[ "$DEFINE_ONLY_SMALL" == "freelist" ]]; then
+    EXTRA_FLAGS="-DBIN_FREE_LIST"
+    MODE_SUFFIX="_freelist"
   fi
 
   echo "🔨 Compiling with ALLOCATOR=$ALLOCATOR, DEALLOCATOR=$DEALLOCATOR $EXTRA_FLAGS"
@@ -60,10 +69,12 @@ for PAIR in "${ALLOCATOR_PAIRS[@]}"; do
       AMOUNT=$((STEP * i))
 
       if [[ "$BENCHMARK" == "varying" ]]; then
-        CMD="./bench $BENCHMARK $AMOUNT"
-        LABEL="${BENCHMARK}_${ALLOCATOR}${MODE_SUFFIX}_amount${AMOUNT}"
-        echo "🚀 Benchmarking $LABEL"
-        hyperfine --warmup 1 --export-csv "./results/${LABEL}.csv" --runs 10 -N "$CMD"
+        for SIZE in "${VARYING_SIZES[@]}"; do
+          CMD="./bench $BENCHMARK $AMOUNT $SIZE"
+          LABEL="${BENCHMARK}_${ALLOCATOR}${MODE_SUFFIX}_amount${AMOUNT}_max${SIZE}"
+          echo "🚀 Benchmarking $LABEL"
+          hyperfine --warmup 1 --export-csv "./results/${LABEL}.csv" --runs 10 -N "$CMD"
+        done
       else
         for SIZE in "${SIZES[@]}"; do
           CMD="./bench $BENCHMARK $AMOUNT $SIZE"
@@ -74,4 +85,9 @@ for PAIR in "${ALLOCATOR_PAIRS[@]}"; do
       fi
     done
   done
+
+  # The classes benchmark times every bin size class itself
+  LABEL="classes_${ALLOCATOR}${MODE_SUFFIX}_amount${TOTAL_AMOUNT}"
+  echo "🚀 Benchmarking $LABEL"
+  ./bench classes "$TOTAL_AMOUNT" | grep -v bench > "./results/${LABEL}.csv"
 done
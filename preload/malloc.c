@@ -0,0 +1,57 @@
+// This replaces the malloc family of the C library with dmalloc when the
+// library is loaded with LD_PRELOAD. dmalloc gets all of its memory from mmap
+// and never calls into the allocator of the C library so no dlsym bootstrap
+// is needed and calls made before any constructor has run are served too
+
+#include "../src/allocator.h"
+#include "../src/mmap_allocator.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// Only the functions of the malloc family are exported from the library
+#define DMALLOC_EXPORT __attribute__((visibility("default")))
+
+// The locks of the allocator must not be held by another thread while the
+// process forks
+__attribute__((constructor)) static void register_fork_handlers() {
+  pthread_atfork(dmalloc_prefork, dmalloc_postfork, dmalloc_postfork);
+}
+
+DMALLOC_EXPORT void *malloc(size_t size) { return dmalloc(size); }
+
+DMALLOC_EXPORT void free(void *ptr) { dfree(ptr); }
+
+DMALLOC_EXPORT void *calloc(size_t num, size_t size) {
+  return dcalloc(num, size);
+}
+
+DMALLOC_EXPORT void *realloc(void *ptr, size_t size) {
+  return drealloc(ptr, size);
+}
+
+DMALLOC_EXPORT int posix_memalign(void **memptr, size_t alignment,
+                                  size_t size) {
+  return dposix_memalign(memptr, alignment, size);
+}
+
+DMALLOC_EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+  return daligned_alloc(alignment, size);
+}
+
+DMALLOC_EXPORT void *memalign(size_t alignment, size_t size) {
+  return dmemalign(alignment, size);
+}
+
+DMALLOC_EXPORT size_t malloc_usable_size(void *ptr) {
+  return dmalloc_usable_size(ptr);
+}
+
+// The obsolete page aligned functions are replaced too since memory from the
+// allocator of the C library can not be freed by dmalloc
+DMALLOC_EXPORT void *valloc(size_t size) {
+  return daligned_alloc(PAGE_SIZE, size);
+}
+
+DMALLOC_EXPORT void *pvalloc(size_t size) {
+  return daligned_alloc(PAGE_SIZE, calculate_num_pages(size) * PAGE_SIZE);
+}
@@ -0,0 +1,258 @@
+#include "address_space.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// The start of the reserved range. It is aligned to COMMIT_STEP so that every
+// committed step covers whole huge pages
+static char *base = NULL;
+
+// The size of the reserved range. It is only set once base is set so a
+// pointer can be checked against the range without taking the lock
+static _Atomic size_t reserved_size = 0;
+
+// The number of bytes that can be reserved, set with DMALLOC_RESERVE_SIZE
+static size_t reserve_size = RESERVE_SIZE;
+
+// The offsets from base of the first page that has not been handed out and
+// of the first page that has not been committed
+static size_t cursor = 0;
+static size_t committed = 0;
+
+// Whether reserving failed, in which case it is not tried again
+static bool reserve_failed = false;
+
+// Protects everything except reserved_size and the purged ranges
+static pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Purged ranges are kept in a lock free stack for every size, which must be
+// a power of 2 pages. Writing the link into a purged range would bring its
+// first page straight back so the links are kept in a table beside the range
+// instead, indexed by the page number of a range relative to base. A link is
+// the page number plus 1 so that 0 ends the stack
+#define MAX_PURGED_SHIFT 63
+
+// The upper half of the top of a stack holds a tag that changes on every
+// update so a stale link is never swapped in (the ABA problem)
+#define LINK_BITS 32
+#define LINK_MASK (((uint64_t)1 << LINK_BITS) - 1)
+
+// The link to the range below every range in a stack
+static _Atomic uint32_t *links = NULL;
+
+// The tagged link to the range on top of the stack for every size
+static _Atomic uint64_t purged[MAX_PURGED_SHIFT + 1] = {0};
+
+// Reserves the range without backing it with memory. Returns false if the os
+// refused
+static bool reserve() {
+  // every page of the range can be linked, the links of ranges that are
+  // never purged are never touched so they cost no memory
+  size_t num_links = reserve_size / PAGE_SIZE;
+  if (num_links > LINK_MASK) {
+    return false;
+  }
+  size_t links_size = calculate_num_pages(num_links * sizeof(*links)) * PAGE_SIZE;
+  void *table = mmap(NULL, links_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  STAT_ADD(mmap_calls, 1);
+  if (table == MAP_FAILED) {
+    return false;
+  }
+
+  // extra space is reserved so that an aligned range must fit
+  size_t mapped_size = reserve_size + COMMIT_STEP;
+  char *ptr = mmap(NULL, mapped_size, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  STAT_ADD(mmap_calls, 1);
+  if (ptr == MAP_FAILED) {
+    munmap(table, links_size);
+    STAT_ADD(munmap_calls, 1);
+    return false;
+  }
+
+  // trimming the reserved memory before and after the aligned range
+  char *aligned =
+      (char *)(((uintptr_t)ptr + COMMIT_STEP - 1) & ~(COMMIT_STEP - 1));
+  size_t head = aligned - ptr;
+  size_t tail = mapped_size - head - reserve_size;
+  if (head) {
+    munmap(ptr, head);
+    STAT_ADD(munmap_calls, 1);
+  }
+  if (tail) {
+    munmap(aligned + reserve_size, tail);
+    STAT_ADD(munmap_calls, 1);
+  }
+
+#if defined(PAGE_STORE_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+  // advising the whole range once keeps it a single mapping, advising every
+  // huge page on its own would split it
+  madvise(aligned, reserve_size, MADV_HUGEPAGE);
+  STAT_ADD(madvise_calls, 1);
+#endif
+
+  links = table;
+  base = aligned;
+  atomic_store_explicit(&reserved_size, reserve_size, memory_order_release);
+  return true;
+}
+
+// Commits the range up to end, rounded up to a whole step. Returns false if
+// the os refused
+static bool commit(size_t end) {
+  if (end <= committed) {
+    return true;
+  }
+
+  size_t new_committed = (end + COMMIT_STEP - 1) & ~(COMMIT_STEP - 1);
+  if (new_committed > reserve_size) {
+    new_committed = reserve_size;
+  }
+
+  int result = mprotect(base + committed, new_committed - committed,
+                        PROT_READ | PROT_WRITE);
+  STAT_ADD(mprotect_calls, 1);
+  if (result != 0) {
+    return false;
+  }
+
+  STAT_ADD(mapped_bytes, new_committed - committed);
+  committed = new_committed;
+  return true;
+}
+
+MmapAllocation address_space_alloc(size_t num_pages, size_t alignment) {
+  size_t size = num_pages * PAGE_SIZE;
+  MmapAllocation allocation = {
+      .size = size,
+      .ptr = NULL,
+  };
+
+  pthread_mutex_lock(&cursor_lock);
+
+  // the range is reserved the first time it is needed
+  if (base == NULL && !reserve_failed) {
+    reserve_failed = !reserve();
+  }
+  if (base == NULL) {
+    pthread_mutex_unlock(&cursor_lock);
+    return allocation;
+  }
+
+  // base is aligned to COMMIT_STEP so aligning the offset aligns the address
+  // for any alignment up to it
+  size_t start = (cursor + alignment - 1) & ~(alignment - 1);
+  if (alignment <= COMMIT_STEP && start + size <= reserve_size &&
+      commit(start + size)) {
+    cursor = start + size;
+    allocation.ptr = base + start;
+  }
+
+  pthread_mutex_unlock(&cursor_lock);
+  return allocation;
+}
+
+// Calculates the index of the stack for a range of num_pages pages
+static inline size_t purged_index(size_t num_pages) {
+  return __builtin_ctzll(num_pages);
+}
+
+void address_space_purge(MmapAllocation allocation) {
+  madvise(allocation.ptr, allocation.size, MADV_DONTNEED);
+
+  STAT_ADD(madvise_calls, 1);
+  STAT_ADD(unmapped_bytes, allocation.size);
+
+  _Atomic uint64_t *top = &purged[purged_index(allocation.size / PAGE_SIZE)];
+  uint32_t link = ((char *)allocation.ptr - base) / PAGE_SIZE + 1;
+
+  uint64_t old_top = atomic_load_explicit(top, memory_order_relaxed);
+  uint64_t new_top;
+  do {
+    atomic_store_explicit(&links[link - 1], (uint32_t)(old_top & LINK_MASK),
+                          memory_order_relaxed);
+    new_top = ((old_top >> LINK_BITS) + 1) << LINK_BITS | link;
+  } while (!atomic_compare_exchange_weak_explicit(
+      top, &old_top, new_top, memory_order_release, memory_order_relaxed));
+}
+
+MmapAllocation address_space_reuse(size_t num_pages) {
+  MmapAllocation allocation = {
+      .size = num_pages * PAGE_SIZE,
+      .ptr = NULL,
+  };
+
+  // nothing can have been purged before the range was reserved
+  if (atomic_load_explicit(&reserved_size, memory_order_acquire) == 0) {
+    return allocation;
+  }
+
+  _Atomic uint64_t *top = &purged[purged_index(num_pages)];
+  uint64_t old_top = atomic_load_explicit(top, memory_order_acquire);
+  uint32_t link;
+  while ((link = old_top & LINK_MASK) != 0) {
+    // the table is never unmapped so a stale link can be read safely, the
+    // exchange then fails since the tag has changed
+    uint32_t next = atomic_load_explicit(&links[link - 1], memory_order_relaxed);
+    uint64_t new_top = ((old_top >> LINK_BITS) + 1) << LINK_BITS | next;
+    if (atomic_compare_exchange_weak_explicit(top, &old_top, new_top,
+                                              memory_order_acquire,
+                                              memory_order_acquire)) {
+      STAT_ADD(mapped_bytes, allocation.size);
+      allocation.ptr = base + (size_t)(link - 1) * PAGE_SIZE;
+      break;
+    }
+  }
+
+  return allocation;
+}
+
+bool address_space_contains(const void *ptr) {
+  // base may only be read once the size is set
+  size_t size = atomic_load_explicit(&reserved_size, memory_order_acquire);
+  // a pointer below base wraps around to a large offset
+  return size != 0 && (uintptr_t)ptr - (uintptr_t)base < size;
+}
+
+void address_space_lock_all() { pthread_mutex_lock(&cursor_lock); }
+
+void address_space_unlock_all() { pthread_mutex_unlock(&cursor_lock); }
+
+// The size of the reserved range can be set with DMALLOC_RESERVE_SIZE. A size
+// of 0 turns the reservation off and every span is mapped on its own
+__attribute__((constructor)) static void init_reserve_size() {
+  const char *value = getenv("DMALLOC_RESERVE_SIZE");
+  if (value == NULL || value[0] == '\0') {
+    return;
+  }
+
+  char *end;
+  unsigned long long size = strtoull(value, &end, 10);
+  switch (*end) {
+  case 'G':
+  case 'g':
+    size <<= 10;
+    // fall through
+  case 'M':
+  case 'm':
+    size <<= 10;
+    // fall through
+  case 'K':
+  case 'k':
+    size <<= 10;
+    end++;
+    break;
+  }
+  if (*end != '\0') {
+    return;
+  }
+
+  // the range is reserved in whole steps
+  size &= ~(COMMIT_STEP - 1);
+  reserve_size = size;
+  reserve_failed = size == 0;
+}
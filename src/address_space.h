@@ -0,0 +1,46 @@
+// This reserves one large range of virtual addresses up front and hands out
+// pages from it by bumping a cursor. Pages are committed in large steps so
+// that refilling the page store rarely needs a system call and the heap stays
+// a single mapping instead of thousands of small ones
+#ifndef ADDRESS_SPACE_H
+#define ADDRESS_SPACE_H
+
+#include "allocator.h"
+#include "mmap_allocator.h"
+#include <stdbool.h>
+
+// The number of bytes reserved by default. It can be changed with the
+// DMALLOC_RESERVE_SIZE environment variable, which takes a number of bytes
+// optionally followed by K, M or G
+#ifndef RESERVE_SIZE
+#define RESERVE_SIZE ((size_t)16 << 30)
+#endif
+
+// The number of bytes committed at a time
+#ifndef COMMIT_STEP
+#define COMMIT_STEP ((size_t)8 << 20)
+#endif
+
+// Allocates num_pages pages aligned to alignment, which must be a power of 2,
+// from the reserved range. The range is reserved on the first call. If the
+// range could not be reserved or is used up ptr is NULL
+MmapAllocation address_space_alloc(size_t num_pages, size_t alignment);
+
+// Gives the memory of pages from the reserved range back to the os. The
+// number of pages must be a power of 2. The addresses stay reserved and are
+// handed out again by address_space_reuse
+void address_space_purge(MmapAllocation allocation);
+
+// Takes back the most recently purged pages of num_pages pages, which must be
+// a power of 2. Their memory reads as zero. If none were purged ptr is NULL
+MmapAllocation address_space_reuse(size_t num_pages);
+
+// Checks whether ptr lies in the reserved range
+DMALLOC_HOT bool address_space_contains(const void *ptr);
+
+// Takes and releases the lock of the cursor so that a fork can not happen
+// while another thread holds it
+void address_space_lock_all();
+void address_space_unlock_all();
+
+#endif
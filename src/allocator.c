@@ -1,8 +1,14 @@
 #include "allocator.h"
+#include "address_space.h"
 #include "bin.h"
+#include "error.h"
 #include "free_list.h"
 #include "huge.h"
 #include "mmap_allocator.h"
+#include "page_map.h"
+#include "page_store.h"
+#include "stats.h"
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,24 +16,29 @@
 
 // #define ONLY_SMALL
 
-// gets the kind of allocation that was made
-// must pass in memory that points to the start of a page
-static inline AllocationType get_allocation_type(AllocationHeader *header) {
-  return header->allocation_type;
+// gets the owner of the memory an allocation was made from. Every page
+// handed out by dmalloc is recorded in the page map so a pointer that is not
+// found was not allocated by dmalloc
+static inline PageOwner get_allocation_owner(void *ptr) {
+  PageOwner page_owner = page_map_get(ptr);
+  if (__builtin_expect(page_owner.owner == NULL, 0)) {
+    invalid_free();
+  }
+
+  return page_owner;
 }
 
-// gets the size of an allocation
+// gets the amount of memory that can be used by an allocation
 static inline size_t get_allocation_size(void *ptr) {
-  void *page_start = calculate_page_start(ptr);
-  AllocationType type = get_allocation_type(page_start);
+  PageOwner page_owner = get_allocation_owner(ptr);
 
-  switch (type) {
+  switch (page_owner.type) {
   case BIN_ALLOCATION_TYPE:
-    return bin_size(page_start);
+    return bin_size(page_owner.owner);
   case FREE_LIST_ALLOCATION_TYPE:
     return free_list_size(ptr);
   case HUGE_ALLOCATION_TYPE:
-    return huge_size(page_start);
+    return huge_usable_size(page_owner.owner);
   }
 }
 
@@ -58,16 +69,137 @@ void *dmalloc(size_t size) {
 #endif
 }
 
+void *daligned_alloc(size_t alignment, size_t size) {
+  // The alignment must be a power of two
+  if (__builtin_expect(alignment == 0 || (alignment & (alignment - 1)), 0)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  // Every allocation is at least aligned to a word, and to MIN_ALIGNMENT if
+  // it is larger than the smallest size class
+  if (alignment <= sizeof(size_t) ||
+      (alignment <= MIN_ALIGNMENT && size > BIN_QUANTUM)) {
+    return dmalloc(size);
+  }
+
+  // Zero-size allocations still get a block
+  if (__builtin_expect(size == 0, 0)) {
+    size = 1;
+  }
+
+  // Fast path: a bin whose blocks are all aligned
+  size_t aligned_size = bin_aligned_size(alignment, size);
+  if (aligned_size != 0) {
+    return bin_alloc(aligned_size);
+  }
+
+#ifndef ONLY_SMALL
+  // Medium allocations: the free list splits off the memory before the
+  // aligned address if a chunk has room for it
+  if (size > MAX_BIN_SIZE && alignment < (PAGE_SIZE / 2) &&
+      size < (PAGE_SIZE / 2) - alignment) {
+    return free_list_aligned_alloc(alignment, size);
+  }
+
+  // Large allocations and large alignments: use whole pages
+  return huge_aligned_alloc(alignment, size);
+#endif
+
+#ifdef ONLY_SMALL
+  return aligned_alloc(alignment, size);
+#endif
+}
+
+int dposix_memalign(void **memptr, size_t alignment, size_t size) {
+  // The alignment must be a power of two multiple of the size of a pointer
+  if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1))) {
+    return EINVAL;
+  }
+
+  void *ptr = daligned_alloc(alignment, size);
+  if (__builtin_expect(ptr == NULL, 0)) {
+    return ENOMEM;
+  }
+
+  *memptr = ptr;
+  return 0;
+}
+
+void *dmemalign(size_t alignment, size_t size) {
+  return daligned_alloc(alignment, size);
+}
+
 void *dcalloc(size_t num, size_t size) {
-  size_t amount = num * size;
+  // the total size must not overflow
+  size_t amount;
+  if (__builtin_expect(__builtin_mul_overflow(num, size, &amount), 0)) {
+    errno = ENOMEM;
+    return NULL;
+  }
 
+  // Zero-size allocations behave like dmalloc
+  if (__builtin_expect(amount == 0, 0)) {
+    return dmalloc(0);
+  }
+
+#ifndef ONLY_SMALL
+  // Every allocator knows which of its memory is still zero so only memory
+  // that was used before is cleared
+  if (__builtin_expect(amount <= MAX_BIN_SIZE, 1)) {
+    return bin_calloc(amount);
+  }
+
+  if (amount < (PAGE_SIZE / 2)) {
+    return free_list_calloc(amount);
+  }
+
+  // Large allocations get fresh pages which are never touched here
+  return huge_calloc(amount);
+#endif
+
+#ifdef ONLY_SMALL
   void *ptr = dmalloc(amount);
-  memset(ptr, 0, amount);
+  if (ptr != NULL) {
+    memset(ptr, 0, amount);
+  }
 
   return ptr;
+#endif
+}
+
+// Tries to resize an allocation without copying it. Only sizes that would be
+// served by the same allocator are resized so that memory does not end up in
+// an allocator that does not suit it. Returns the resized allocation or NULL
+static inline void *resize_in_place(void *ptr, size_t new_size) {
+  PageOwner page_owner = get_allocation_owner(ptr);
+
+  switch (page_owner.type) {
+  case BIN_ALLOCATION_TYPE:
+    // nothing needs to happen if the size still rounds up to the bin class
+    if (new_size <= MAX_BIN_SIZE &&
+        BIN_CLASS_SIZE(BIN_CLASS_INDEX(new_size)) ==
+            bin_size(page_owner.owner)) {
+      return ptr;
+    }
+    break;
+  case FREE_LIST_ALLOCATION_TYPE:
+    if (new_size > MAX_BIN_SIZE && new_size < (PAGE_SIZE / 2) &&
+        free_list_resize(ptr, page_owner.owner, new_size)) {
+      return ptr;
+    }
+    break;
+  case HUGE_ALLOCATION_TYPE:
+    if (new_size >= (PAGE_SIZE / 2)) {
+      return huge_realloc(ptr, page_owner.owner, new_size);
+    }
+    break;
+  }
+
+  return NULL;
 }
 
-// The allocator does not currently support resizing memory allocations in place
 void *drealloc(void *ptr, size_t new_size) {
   // Fast path: handle NULL pointer (equivalent to malloc)
   if (__builtin_expect(ptr == NULL, 0)) {
@@ -80,53 +212,31 @@ void *drealloc(void *ptr, size_t new_size) {
     return NULL;
   }
 
+#ifndef ONLY_SMALL
+  // Fast path: grow or shrink the allocation where it is
+  void *resized = resize_in_place(ptr, new_size);
+  if (resized != NULL) {
+    return resized;
+  }
+#endif
+
   // Get size of current allocation
   size_t current_size = get_allocation_size(ptr);
-  
-  // Fast path: if sizes are the same, no need to reallocate
-  if (current_size == new_size) {
-    return ptr;
-  }
-  
-  // Optimization: if new size is smaller and significantly so,
-  // still reallocate to avoid wasting memory
-  if (new_size < current_size && new_size <= (current_size / 2)) {
-    // Allocate new smaller block
-    void *new_ptr = dmalloc(new_size);
-    if (__builtin_expect(new_ptr == NULL, 0)) {
-      // If allocation fails, return original pointer
-      return ptr;
-    }
-    
-    // Copy data to new location
-    memcpy(new_ptr, ptr, new_size);
-    
-    // Free old memory
-    dfree(ptr);
-    
-    return new_ptr;
-  }
-  
-  // If new size is larger or only slightly smaller
-  if (new_size > current_size || new_size > (current_size / 2)) {
-    // Allocate new block
-    void *new_ptr = dmalloc(new_size);
-    if (__builtin_expect(new_ptr == NULL, 0)) {
-      // If allocation fails, return original pointer
-      return ptr;
-    }
-    
-    // Copy data to new location (use smaller of two sizes)
-    memcpy(new_ptr, ptr, (current_size < new_size) ? current_size : new_size);
-    
-    // Free old memory
-    dfree(ptr);
-    
-    return new_ptr;
+
+  // Allocate new block
+  void *new_ptr = dmalloc(new_size);
+  if (__builtin_expect(new_ptr == NULL, 0)) {
+    // If allocation fails the original memory is left untouched
+    return NULL;
   }
-  
-  // Default case: return original pointer
-  return ptr;
+
+  // Copy data to new location (use smaller of two sizes)
+  memcpy(new_ptr, ptr, (current_size < new_size) ? current_size : new_size);
+
+  // Free old memory
+  dfree(ptr);
+
+  return new_ptr;
 }
 
 void dfree(void *ptr) {
@@ -137,24 +247,23 @@ void dfree(void *ptr) {
   
 #ifndef ONLY_SMALL
   // Fast path: determine allocation type
-  void *page_start = calculate_page_start(ptr);
-  AllocationType type = get_allocation_type(page_start);
+  PageOwner page_owner = get_allocation_owner(ptr);
   
   // Use switch with likely/unlikely hints for better branch prediction
-  switch (type) {
+  switch (page_owner.type) {
     case BIN_ALLOCATION_TYPE:
       // Most common case for small allocations
-      bin_free(ptr, page_start);
+      bin_free(ptr, page_owner.owner);
       break;
       
     case FREE_LIST_ALLOCATION_TYPE:
       // Medium allocations
-      free_list_free(ptr, page_start);
+      free_list_free(ptr, page_owner.owner);
       break;
       
     case HUGE_ALLOCATION_TYPE:
       // Large allocations
-      huge_free(ptr);
+      huge_free(page_owner.owner);
       break;
   }
 #endif
@@ -168,3 +277,96 @@ void dfree(void *ptr) {
   }
 #endif
 }
+
+void dfree_sized(void *ptr, size_t size) {
+  // Fast path: handle NULL pointer
+  if (__builtin_expect(ptr == NULL, 0)) {
+    return;
+  }
+
+  // Fast path: the size tells which bin class the memory belongs to
+  if (__builtin_expect(size <= MAX_BIN_SIZE, 1)) {
+    bin_free_sized(ptr, size == 0 ? 1 : size);
+    return;
+  }
+
+#ifndef ONLY_SMALL
+  // Medium allocations: chunks are a single page
+  if (size < (PAGE_SIZE / 2)) {
+    free_list_free(ptr, calculate_page_start(ptr));
+    return;
+  }
+#endif
+
+  dfree(ptr);
+}
+
+size_t dmalloc_usable_size(void *ptr) {
+  if (ptr == NULL) {
+    return 0;
+  }
+
+  return get_allocation_size(ptr);
+}
+
+size_t dmalloc_batch(size_t size, size_t n, void **out) {
+  // Zero-size allocations get the smallest blocks
+  if (__builtin_expect(size == 0, 0)) {
+    size = 1;
+  }
+
+  // Fast path: blocks are taken from the bins in runs
+  if (__builtin_expect(size <= MAX_BIN_SIZE, 1)) {
+    return bin_alloc_batch(size, n, out);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    out[i] = dmalloc(size);
+    if (__builtin_expect(out[i] == NULL, 0)) {
+      return i;
+    }
+  }
+
+  return n;
+}
+
+void dfree_batch(void **ptrs, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    void *ptr = ptrs[i];
+    if (ptr == NULL) {
+      i++;
+      continue;
+    }
+
+#ifndef ONLY_SMALL
+    // Pointers into the same bin that follow each other are freed together
+    PageOwner page_owner = get_allocation_owner(ptr);
+    if (page_owner.type == BIN_ALLOCATION_TYPE) {
+      i += bin_free_batch(page_owner.owner, ptrs + i, n - i);
+      continue;
+    }
+#endif
+
+    dfree(ptr);
+    i++;
+  }
+}
+
+void dmalloc_set_store_size(size_t spans) { set_store_size(spans); }
+
+void dmalloc_prefork() {
+  bin_lock_all();
+  free_list_lock_all();
+  huge_lock_all();
+  address_space_lock_all();
+  stats_lock_all();
+}
+
+void dmalloc_postfork() {
+  stats_unlock_all();
+  address_space_unlock_all();
+  huge_unlock_all();
+  free_list_unlock_all();
+  bin_unlock_all();
+}
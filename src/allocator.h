@@ -1,6 +1,7 @@
 #ifndef ALLOCATOR_H
 #define ALLOCATOR_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 // Define compiler optimization attributes
@@ -12,6 +13,10 @@
 #define DMALLOC_CONST __attribute__((const))
 #define DMALLOC_MALLOC __attribute__((malloc))
 
+// The alignment of max_align_t, which memory that can hold any object must
+// have. Every allocation larger than 8 bytes is aligned to it
+#define MIN_ALIGNMENT 16
+
 // The type of allocator used to make an allocation,
 // this is used when freeing memory to determine
 // what allocator to use to free the memory
@@ -34,12 +39,70 @@ DMALLOC_HOT DMALLOC_MALLOC void *dmalloc(size_t size);
 // Equivalent to calloc
 DMALLOC_HOT DMALLOC_MALLOC void *dcalloc(size_t num, size_t size);
 
+// Equivalent to aligned_alloc. The alignment must be a power of two, NULL is
+// returned otherwise
+DMALLOC_MALLOC void *daligned_alloc(size_t alignment, size_t size);
+
+// Equivalent to posix_memalign
+int dposix_memalign(void **memptr, size_t alignment, size_t size);
+
+// Equivalent to memalign
+DMALLOC_MALLOC void *dmemalign(size_t alignment, size_t size);
+
 // Equivalent to realloc
 DMALLOC_HOT DMALLOC_MALLOC void *drealloc(void *ptr, size_t new_size);
 
 // Equivalent to free
 DMALLOC_HOT void dfree(void *ptr);
 
+// Equivalent to free_sized. The size must be the one the memory was
+// allocated or last reallocated with, which lets the memory be freed without
+// looking up where it came from. It must not be used for aligned allocations
+DMALLOC_HOT void dfree_sized(void *ptr, size_t size);
+
+// Equivalent to malloc_usable_size. All of the memory it reports can be used
+size_t dmalloc_usable_size(void *ptr);
+
+// Allocates n objects of the same size and stores them in out. Returns the
+// number of objects allocated, which is less than n if out of memory
+DMALLOC_HOT size_t dmalloc_batch(size_t size, size_t n, void **out);
+
+// Frees n pointers. Pointers into the same bin should be next to each other
+// since those are freed together, for example as returned by dmalloc_batch
+DMALLOC_HOT void dfree_batch(void **ptrs, size_t n);
+
+// Sets the number of free spans of every size that are kept for reuse
+// instead of being returned to the os. It can also be set with the
+// DMALLOC_STORE_SIZE environment variable. The number grows on its own for
+// span sizes that are returned and mapped again over and over
+void dmalloc_set_store_size(size_t spans);
+
+// Gives the memory of spans and huge mappings that have been cached for
+// longer than the decay time back to the os, and returns the empty bins the
+// calling thread kept for that long to the page store. Returns the number of
+// bytes given back to the os. Programs without the purge thread can call it
+// from time to time
+size_t dmalloc_maintenance();
+
+// Sets the number of milliseconds memory stays cached before
+// dmalloc_maintenance gives it back. It can also be set with the
+// DMALLOC_DECAY_TIME environment variable
+void dmalloc_set_decay_time(size_t milliseconds);
+
+// Starts a thread that calls dmalloc_maintenance twice per decay time.
+// It is started on load if the DMALLOC_PURGE_THREAD environment variable is
+// set. Returns false if the thread could not be created
+bool dmalloc_start_purge_thread();
+
+// Stops the purge thread and waits for it to exit
+void dmalloc_stop_purge_thread();
+
+// Takes all locks of the allocator before a fork and releases them after it,
+// in the parent and the child, so the child never finds a lock held by a
+// thread that does not exist in it. Meant to be passed to pthread_atfork
+void dmalloc_prefork();
+void dmalloc_postfork();
+
 DMALLOC_PURE size_t num_bins();
 
 #endif
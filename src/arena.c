@@ -0,0 +1,168 @@
+#include "arena.h"
+#include "mmap_allocator.h"
+#include "page_store.h"
+#include <stdint.h>
+#include <sys/mman.h>
+
+_Static_assert(ARENA_SPAN_SHIFT <= MAX_SPAN_SHIFT,
+               "Arena spans must fit in the page store");
+
+// A run of pages that memory is allocated from. It sits at the start of the
+// pages
+typedef struct ArenaChunk {
+  // the next chunk of the arena
+  struct ArenaChunk *next;
+  // the pages of the chunk
+  MmapAllocation allocation;
+} ArenaChunk;
+
+// The arena lives in its first chunk after the chunk header
+struct DArena {
+  // the chunks retrieved from the page store, in the order they are used in
+  ArenaChunk *chunks;
+  // the chunk memory is being allocated from
+  ArenaChunk *current;
+  // the next free byte of the current chunk and the end of the chunk
+  char *bump;
+  char *end;
+  // chunks mapped for single allocations too large for a span
+  ArenaChunk *large;
+};
+
+// Rounds a size up to the alignment of arena allocations
+static inline size_t align_size(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// The size of the chunk header, keeping the memory after it aligned
+#define CHUNK_HEADER_SIZE (align_size(sizeof(ArenaChunk)))
+
+// The size of the arena, keeping the memory after it aligned
+#define ARENA_SIZE (align_size(sizeof(DArena)))
+
+// Gets the first byte of a chunk that can be allocated. The first chunk also
+// holds the arena
+static inline char *chunk_memory(DArena *arena, ArenaChunk *chunk) {
+  char *memory = (char *)chunk + CHUNK_HEADER_SIZE;
+  return chunk == arena->chunks ? memory + ARENA_SIZE : memory;
+}
+
+// Starts allocating from a chunk
+static inline void use_chunk(DArena *arena, ArenaChunk *chunk) {
+  arena->current = chunk;
+  arena->bump = chunk_memory(arena, chunk);
+  arena->end = (char *)chunk->allocation.ptr + chunk->allocation.size;
+}
+
+// Retrieves a span from the page store and puts a chunk header in it
+static ArenaChunk *retrieve_chunk() {
+  MmapAllocation allocation = retrieve_span(ARENA_SPAN_SHIFT, NULL);
+  if (__builtin_expect(allocation.ptr == NULL, 0)) {
+    return NULL;
+  }
+
+  ArenaChunk *chunk = allocation.ptr;
+  chunk->next = NULL;
+  chunk->allocation = allocation;
+  return chunk;
+}
+
+DArena *darena_create() {
+  ArenaChunk *chunk = retrieve_chunk();
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  DArena *arena = (DArena *)((char *)chunk + CHUNK_HEADER_SIZE);
+  arena->chunks = chunk;
+  arena->large = NULL;
+  use_chunk(arena, chunk);
+
+  return arena;
+}
+
+// Maps a chunk of its own for an allocation that does not fit in a span
+static void *allocate_large(DArena *arena, size_t size) {
+  MmapAllocation allocation =
+      mmap_alloc(calculate_num_pages(CHUNK_HEADER_SIZE + size));
+  if (__builtin_expect(allocation.ptr == MAP_FAILED, 0)) {
+    return NULL;
+  }
+
+  ArenaChunk *chunk = allocation.ptr;
+  chunk->next = arena->large;
+  chunk->allocation = allocation;
+  arena->large = chunk;
+
+  return (char *)chunk + CHUNK_HEADER_SIZE;
+}
+
+// Moves on to the next chunk, reusing chunks kept from before a reset
+static DMALLOC_NOINLINE void *allocate_from_next_chunk(DArena *arena,
+                                                       size_t size) {
+  size_t span_size = PAGE_SIZE << ARENA_SPAN_SHIFT;
+  if (size > span_size - CHUNK_HEADER_SIZE) {
+    return allocate_large(arena, size);
+  }
+
+  ArenaChunk *chunk = arena->current->next;
+  if (chunk == NULL) {
+    chunk = retrieve_chunk();
+    if (__builtin_expect(chunk == NULL, 0)) {
+      return NULL;
+    }
+    arena->current->next = chunk;
+  }
+  use_chunk(arena, chunk);
+
+  void *ptr = arena->bump;
+  arena->bump += size;
+  return ptr;
+}
+
+void *darena_alloc(DArena *arena, size_t size) {
+  // sizes this large can not be rounded up and never fit in memory anyway
+  if (__builtin_expect(size > PTRDIFF_MAX, 0)) {
+    return NULL;
+  }
+  size = align_size(size);
+
+  // Fast path: the allocation fits in the current chunk
+  if (__builtin_expect((size_t)(arena->end - arena->bump) >= size, 1)) {
+    void *ptr = arena->bump;
+    arena->bump += size;
+    return ptr;
+  }
+
+  return allocate_from_next_chunk(arena, size);
+}
+
+// Unmaps the chunks of allocations that were too large for a span
+static void release_large_chunks(DArena *arena) {
+  ArenaChunk *chunk = arena->large;
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    mmap_free(chunk->allocation);
+    chunk = next;
+  }
+
+  arena->large = NULL;
+}
+
+void darena_reset(DArena *arena) {
+  release_large_chunks(arena);
+  use_chunk(arena, arena->chunks);
+}
+
+void darena_destroy(DArena *arena) {
+  release_large_chunks(arena);
+
+  // The arena lives in the first chunk so the chunks are read before the
+  // first one is stored
+  ArenaChunk *chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    store_span(chunk->allocation);
+    chunk = next;
+  }
+}
@@ -0,0 +1,36 @@
+// This is for an allocator that hands out memory by bumping a pointer
+// through runs of pages and frees all of it at once. It suits objects that
+// die together, like the nodes of one generation of a program. An arena is
+// not thread safe and its memory must not be passed to dfree
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "allocator.h"
+#include <stddef.h>
+
+// The pages of an arena are retrieved from the page store in spans of
+// 2^ARENA_SPAN_SHIFT pages
+#ifndef ARENA_SPAN_SHIFT
+#define ARENA_SPAN_SHIFT 4
+#endif
+
+// Every allocation of an arena is aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+
+typedef struct DArena DArena;
+
+// Creates an empty arena or returns NULL if out of memory
+DArena *darena_create();
+
+// Allocates memory from the arena. It stays valid until the arena is reset
+// or destroyed
+DMALLOC_HOT DMALLOC_MALLOC void *darena_alloc(DArena *arena, size_t size);
+
+// Frees all memory allocated from the arena at once. The pages are kept for
+// the allocations made after the reset
+void darena_reset(DArena *arena);
+
+// Frees all memory allocated from the arena and the arena itself
+void darena_destroy(DArena *arena);
+
+#endif
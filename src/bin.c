@@ -1,9 +1,26 @@
 #include "bin.h"
 #include "allocator.h"
 #include "bitset.h"
+#include "decay.h"
 #include "mmap_allocator.h"
+#include "page_map.h"
 #include "page_store.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+
+// The state of a thread that owns bins. Other threads signal it when they
+// free memory into one of its bins. Owners are recycled instead of unmapped so
+// a late signal from another thread never touches unmapped memory
+typedef struct Owner {
+  // The number of remote frees made to the owner's bins since it last looked
+  atomic_size_t remote_frees;
+  // The next owner in the pool of unused owners
+  struct Owner *next;
+} Owner;
 
 // A bin and all its metadata
 typedef struct Bin {
@@ -16,51 +33,128 @@ typedef struct Bin {
   struct Bin *prev;
   // the next bin
   struct Bin *next;
+  // the thread that owns the bin, NULL if the thread has exited
+  _Atomic(Owner *) owner;
   // the size of the objects allocated in the bin
   size_t bin_size;
+  // 2^32 / bin_size rounded up, used to turn the division by bin_size into a
+  // multiplication
+  uint64_t reciprocal;
+  // the index of the size class of the bin
+  size_t index;
+  // the number of blocks in the bin
+  size_t num_blocks;
   // Cache the number of free blocks for faster allocation decisions
   size_t free_blocks;
+  // whether the bin is in the list of full bins instead of the list of bins
+  // with free blocks
+  bool full;
+  // Blocks from this index on have never been allocated since the span was
+  // mapped so they are still zero
+  size_t untouched;
+  // Blocks freed by threads that do not own the bin. Each free block holds
+  // a pointer to the next one. Only the owner takes blocks off the queue
+  _Atomic(void *) remote_frees;
+#ifdef BIN_FREE_LIST
+  // Blocks that were freed. Each free block holds a pointer to the next one
+  void *free_list;
+  // Blocks from this index on have never been handed out
+  size_t bump;
+#else
   // the free spots in the bin
   BitSet bitset;
+#endif
 } Bin;
 
-// The bins to where memory can be allocated to
-static Bin *bins[NUM_BINS] = {[0 ... NUM_BINS - 1] = NULL};
-
-// Cache for recently used bins to improve locality
-static Bin *recent_bins[NUM_BINS] = {[0 ... NUM_BINS - 1] = NULL};
-
-// Precomputed bin sizes for faster lookup
-static const size_t BIN_SIZES[NUM_BINS] = {1, 2, 4, 8, 16, 32, 64, 128};
-
-// Precomputed lookup table for bin indices (for sizes 0-128)
-static const unsigned char BIN_INDEX_LOOKUP[129] = {
-    0, 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7,
-    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-};
+// The bins with free blocks where memory can be allocated to. Every thread
+// has its own and always allocates from the first one
+static _Thread_local Bin *bins[NUM_BINS] = {[0 ... NUM_BINS - 1] = NULL};
+
+// The bins without free blocks. A bin moves between the lists when its last
+// free block is allocated or when a block is freed into it again. Empty bins
+// are returned to the page store
+static _Thread_local Bin *full_bins[NUM_BINS] = {[0 ... NUM_BINS - 1] = NULL};
+
+// An empty bin of every size class that is kept instead of being returned to
+// the page store, so a size class that keeps crossing the boundary of a bin
+// does not set up and release a bin every time
+static _Thread_local Bin *empty_bins[NUM_BINS] = {[0 ... NUM_BINS - 1] = NULL};
+
+// The number of other bins of the size class that became empty while the
+// kept bin stayed empty, and when the kept bin last became empty on the clock
+// of decay_clock
+static _Thread_local uint32_t empty_bin_retires[NUM_BINS] = {0};
+static _Thread_local uint32_t empty_bin_since[NUM_BINS] = {0};
+
+// The owner of the bins of the current thread
+static _Thread_local Owner *thread_owner = NULL;
+
+// Owners that can be reused by new threads
+static Owner *owner_pool = NULL;
+
+// Bins of threads that have exited waiting to be adopted by another thread
+static _Atomic(Bin *) abandoned_bins[NUM_BINS] = {[0 ... NUM_BINS - 1] = NULL};
+
+// Protects owner_pool and abandoned_bins
+static pthread_mutex_t bin_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Used to abandon the bins of a thread when it exits
+static pthread_key_t owner_key;
+static pthread_once_t owner_key_once = PTHREAD_ONCE_INIT;
+
+// The span shift of every size class. The page size is only known at run
+// time so they are calculated once before the first bin is created
+static size_t span_shifts[NUM_BINS];
+
+// The number of bits in a word of a bitset
+#define BITS_PER_WORD (sizeof(WORD) * 8)
+
+// Generates the entries of a table at compile time by applying f to the
+// indices i to i + n - 1
+#define TABLE_1(f, i) f(i)
+#define TABLE_2(f, i) TABLE_1(f, i), TABLE_1(f, (i) + 1)
+#define TABLE_4(f, i) TABLE_2(f, i), TABLE_2(f, (i) + 2)
+#define TABLE_8(f, i) TABLE_4(f, i), TABLE_4(f, (i) + 4)
+#define TABLE_16(f, i) TABLE_8(f, i), TABLE_8(f, (i) + 8)
+#define TABLE_32(f, i) TABLE_16(f, i), TABLE_16(f, (i) + 16)
+#define TABLE_64(f, i) TABLE_32(f, i), TABLE_32(f, (i) + 32)
+#define TABLE_128(f, i) TABLE_64(f, i), TABLE_64(f, (i) + 64)
+#define TABLE_256(f, i) TABLE_128(f, i), TABLE_128(f, (i) + 128)
+#define TABLE_512(f, i) TABLE_256(f, i), TABLE_256(f, (i) + 256)
+
+// The size class of an allocation of a number of BIN_QUANTUM sized granules
+#define GRANULE_CLASS_INDEX(granules) BIN_CLASS_INDEX((granules) * BIN_QUANTUM)
+
+// Precomputed bin sizes for faster lookup. Generated for the largest supported
+// number of bins, only the first NUM_BINS are used
+static const size_t BIN_SIZES[] = {TABLE_64(BIN_CLASS_SIZE, 0)};
+
+// Precomputed lookup table for bin indices indexed by the number of granules
+// of an allocation (for sizes 0-4096)
+static const unsigned char BIN_INDEX_LOOKUP[] = {
+    TABLE_512(GRANULE_CLASS_INDEX, 0), GRANULE_CLASS_INDEX(512)};
+
+_Static_assert(BIN_CLASS_SIZE(NUM_BINS - 1) == MAX_BIN_SIZE,
+               "MAX_BIN_SIZE must be the size of a size class");
+_Static_assert(NUM_BINS <= sizeof(BIN_SIZES) / sizeof(BIN_SIZES[0]),
+               "Too many bins for the size table");
+_Static_assert(MAX_BIN_SIZE / BIN_QUANTUM < sizeof(BIN_INDEX_LOOKUP),
+               "MAX_BIN_SIZE is too large for the lookup table");
 
 // Checks if a bin is empty (no memory is allocated to it)
 static inline bool is_bin_empty(Bin *bin) {
-  return bin->free_blocks == bin->bitset.num_bits;
+  return bin->free_blocks == bin->num_blocks;
 }
 
 // Optimized bin index calculation with lookup table for common sizes
 static inline size_t bin_index(size_t size) {
-  // Fast path for most common small sizes using lookup table
-  if (__builtin_expect(size <= 128, 1)) {
-    return BIN_INDEX_LOOKUP[size];
+  // Fast path for all bin sizes using lookup table
+  if (__builtin_expect(size <= MAX_BIN_SIZE, 1)) {
+    return BIN_INDEX_LOOKUP[(size + BIN_QUANTUM - 1) / BIN_QUANTUM];
   }
 
-  // Handle edge case
-  if (size <= 1)
-    return 0;
-
   // Use built-in leading zero count for larger sizes
-  return (sizeof(size_t) * 8) - __builtin_clzll(size - 1);
+  return BIN_CLASS_INDEX(size);
 }
 
 // Fast bin size lookup using precomputed table
@@ -68,10 +162,51 @@ static inline size_t calculate_bin_size(size_t index) {
   return BIN_SIZES[index];
 }
 
+// Calculates the shift of the number of pages in a bin of the size class.
+// Larger objects get larger spans so that the cost of the Bin header and of
+// retrieving the span is shared by enough objects
+static inline size_t calculate_span_shift(size_t index) {
+  size_t bin_size = calculate_bin_size(index);
+  size_t shift = 0;
+
+  while (shift < MAX_SPAN_SHIFT &&
+         (PAGE_SIZE << shift) / bin_size < BIN_SPAN_OBJECTS) {
+    shift++;
+  }
+
+  return shift;
+}
+
+// The alignment of the blocks of a bin. The first block is aligned to the
+// largest power of two that divides the block size so that every block is,
+// which gives power of two sizes their natural alignment
+static inline size_t calculate_block_alignment(size_t block_size) {
+  return block_size & -block_size;
+}
+
+// The amount of memory in a span that blocks can be placed in, excluding the
+// Bin structure and the padding needed to align the first block
+static inline size_t calculate_block_memory(size_t block_size,
+                                            size_t span_size) {
+  return span_size - sizeof(Bin) - (calculate_block_alignment(block_size) - 1);
+}
+
+#ifdef BIN_FREE_LIST
+// Calculates the number of blocks that fit in a bin. Free blocks are tracked
+// in the blocks themselves so no memory is needed for that
+static size_t calculate_num_blocks(size_t block_size, size_t span_size) {
+  return calculate_block_memory(block_size, span_size) / block_size;
+}
+
+// Gets the size of the memory used to track the free blocks of a bin
+static inline size_t size_of_free_blocks(size_t num_blocks) {
+  (void)num_blocks;
+  return 0;
+}
+#else
 // Calculates the number of bits needed for the bitset
-static size_t calculate_bitset_size(size_t block_size) {
-  // The amount of memory available (excluding the Bin structure)
-  size_t total_memory_available = PAGE_SIZE - sizeof(Bin);
+static size_t calculate_num_blocks(size_t block_size, size_t span_size) {
+  size_t total_memory_available = calculate_block_memory(block_size, span_size);
 
   // Initial estimate of total blocks
   size_t total_blocks = total_memory_available / block_size;
@@ -90,200 +225,704 @@ static size_t calculate_bitset_size(size_t block_size) {
   return new_total_blocks;
 }
 
-static void init_bin(Bin *bin, size_t bin_size, MmapAllocation allocation) {
+// Gets the size of the memory used to track the free blocks of a bin
+static inline size_t size_of_free_blocks(size_t num_blocks) {
+  return size_of_bitset(num_blocks);
+}
+#endif
+
+static void init_bin(Bin *bin, size_t index, Owner *owner,
+                     MmapAllocation allocation, bool zeroed) {
   // Set allocation type
   bin->header.allocation_type = BIN_ALLOCATION_TYPE;
 
   // Set mmap allocation
   bin->mmap_allocation = allocation;
 
-  // Set bin size
+  // Set the size class and owner
+  size_t bin_size = calculate_bin_size(index);
   bin->bin_size = bin_size;
+  bin->reciprocal = ((uint64_t)UINT32_MAX / bin_size) + 1;
+  bin->index = index;
+  atomic_init(&bin->owner, owner);
+  atomic_init(&bin->remote_frees, NULL);
+  bin->full = false;
 
   // Initialize linked list pointers
   bin->prev = NULL;
   bin->next = NULL;
 
-  // Calculate bitset size
-  size_t num_bits = calculate_bitset_size(bin_size);
+  // Calculate the number of blocks
+  size_t num_blocks = calculate_num_blocks(bin_size, allocation.size);
 
   // Initialize free block count
-  bin->free_blocks = num_bits;
+  bin->num_blocks = num_blocks;
+  bin->free_blocks = num_blocks;
+
+  // The blocks of a span that was used before can hold anything
+  bin->untouched = zeroed ? 0 : num_blocks;
 
-  // Initialize bitset
-  init_bitset(&bin->bitset, num_bits);
+  // Initialize the free blocks
+#ifdef BIN_FREE_LIST
+  bin->free_list = NULL;
+  bin->bump = 0;
+#else
+  init_bitset(&bin->bitset, num_blocks);
+#endif
 
   // Calculate pointer to the memory region for allocations
-  size_t bitset_mem_size = size_of_bitset(num_bits);
-  bin->ptr = (void *)((char *)bin + sizeof(Bin) + bitset_mem_size);
+  size_t alignment = calculate_block_alignment(bin_size);
+  uintptr_t blocks =
+      (uintptr_t)bin + sizeof(Bin) + size_of_free_blocks(num_blocks);
+  bin->ptr = (void *)((blocks + alignment - 1) & ~(alignment - 1));
+}
+
+// Gets the list of the current thread that the bin belongs in
+static inline Bin **bin_list(Bin *bin) {
+  return bin->full ? &full_bins[bin->index] : &bins[bin->index];
+}
+
+// Inserts a bin at the head of its list of the current thread
+static inline void push_bin(Bin *bin) {
+  Bin **list = bin_list(bin);
+
+  bin->next = *list;
+  bin->prev = NULL;
+  if (*list != NULL) {
+    (*list)->prev = bin;
+  }
+  *list = bin;
+}
+
+// Removes a bin from its list of the current thread
+static inline void unlink_bin(Bin *bin) {
+  if (bin->prev == NULL) {
+    // This bin is the head
+    *bin_list(bin) = bin->next;
+    if (bin->next != NULL) {
+      bin->next->prev = NULL;
+    }
+  } else {
+    // This bin is in the middle or end of the list
+    bin->prev->next = bin->next;
+    if (bin->next != NULL) {
+      bin->next->prev = bin->prev;
+    }
+  }
+}
+
+// Moves a bin to the list of full bins or back to the list of bins with free
+// blocks
+static inline void move_bin(Bin *bin, bool full) {
+  unlink_bin(bin);
+  bin->full = full;
+  push_bin(bin);
+}
+
+// Counts n blocks of a bin as allocated. The bin is moved to the full bins
+// once it has no free blocks left
+static inline void count_allocated_blocks(Bin *bin, size_t n) {
+  bin->free_blocks -= n;
+  STAT_ADD(bin_allocs[bin->index], n);
+
+  if (__builtin_expect(bin->free_blocks == 0, 0)) {
+    move_bin(bin, true);
+  }
+}
+
+// Counts n blocks of a bin as freed. A full bin is moved back to the bins
+// with free blocks
+static inline void count_freed_blocks(Bin *bin, size_t n) {
+  if (__builtin_expect(bin->full, 0)) {
+    move_bin(bin, false);
+  }
+
+  bin->free_blocks += n;
+}
+
+// Frees a block of memory in a bin owned by the current thread
+static inline void free_mem_in_bin(void *ptr, Bin *bin) {
+#ifdef BIN_FREE_LIST
+  *(void **)ptr = bin->free_list;
+  bin->free_list = ptr;
+#else
+  // Fast path: calculate index of the allocation. The multiplication is exact
+  // for offsets that are multiples of bin_size that fit in a span
+  uint64_t offset = (char *)ptr - (char *)bin->ptr;
+  size_t index = (offset * bin->reciprocal) >> 32;
+
+  // Unmark the bit in the bitset
+  unmark_bit(&bin->bitset, index);
+#endif
+  count_freed_blocks(bin, 1);
+}
+
+// Takes the blocks freed by other threads off the queue of a bin owned by the
+// current thread. Returns true if any blocks were freed
+static bool collect_remote_frees(Bin *bin) {
+  // Fast path: nothing has been freed remotely
+  if (atomic_load_explicit(&bin->remote_frees, memory_order_relaxed) == NULL) {
+    return false;
+  }
+
+  void *block = atomic_exchange_explicit(&bin->remote_frees, NULL,
+                                         memory_order_acquire);
+  while (block != NULL) {
+    void *next = *(void **)block;
+    free_mem_in_bin(block, bin);
+    block = next;
+  }
+
+  return true;
+}
+
+// Removes an empty bin from the current thread and returns its page to the
+// store
+static inline void release_bin(Bin *bin) {
+  unlink_bin(bin);
+  STAT_ADD(bins_released, 1);
+
+  // The pages of the span are no longer owned by the bin
+  MmapAllocation allocation = bin->mmap_allocation;
+  page_map_clear(allocation.ptr, allocation.size / PAGE_SIZE);
+
+  store_span(allocation);
+}
+
+// Adds a list of bins of an exiting thread to the abandoned bins
+static void abandon_bin_list(Bin *bin, size_t index) {
+  while (bin) {
+    Bin *next = bin->next;
+
+    atomic_store_explicit(&bin->owner, NULL, memory_order_release);
+    bin->prev = NULL;
+    bin->next =
+        atomic_load_explicit(&abandoned_bins[index], memory_order_relaxed);
+    atomic_store_explicit(&abandoned_bins[index], bin, memory_order_relaxed);
+
+    bin = next;
+  }
+}
+
+// Handles a bin of the current thread that has become empty. The first empty
+// bin of a size class is kept, further ones are returned to the store while
+// it is still empty. The kept bin itself is not released here so that a walk
+// over the list it is in can go on past it
+static inline void retire_empty_bin(Bin *bin) {
+  size_t index = bin->index;
+  Bin *kept = empty_bins[index];
+  if (kept == bin) {
+    // the kept bin was used again
+    empty_bin_retires[index] = 0;
+    empty_bin_since[index] = decay_clock();
+    return;
+  }
+
+  if (kept != NULL && is_bin_empty(kept)) {
+    release_bin(bin);
+    empty_bin_retires[index]++;
+  } else {
+    empty_bins[index] = bin;
+    empty_bin_retires[index] = 0;
+    empty_bin_since[index] = decay_clock();
+  }
+}
+
+// A size class that keeps emptying other bins while the kept one stays empty
+// is shrinking, so after EMPTY_BIN_RETIRES of them the kept bin is returned
+// to the store too
+static inline void release_unused_kept_bin(size_t index) {
+  Bin *kept = empty_bins[index];
+  if (__builtin_expect(empty_bin_retires[index] >= EMPTY_BIN_RETIRES, 0) &&
+      kept != NULL && is_bin_empty(kept)) {
+    release_bin(kept);
+    empty_bins[index] = NULL;
+    empty_bin_retires[index] = 0;
+  }
+}
+
+void bin_decay_empty_bins(uint32_t now, uint32_t idle) {
+  for (size_t i = 0; i < NUM_BINS; i++) {
+    Bin *kept = empty_bins[i];
+    if (kept != NULL && is_bin_empty(kept) &&
+        (uint32_t)(now - empty_bin_since[i]) >= idle) {
+      release_bin(kept);
+      empty_bins[i] = NULL;
+      empty_bin_retires[i] = 0;
+    }
+  }
+}
+
+// Hands the bins of an exiting thread over to the abandoned bins so that
+// other threads can adopt them. The owner is returned to the pool
+static void abandon_bins(void *arg) {
+  Owner *owner = arg;
+
+  pthread_mutex_lock(&bin_lock);
+  for (size_t i = 0; i < NUM_BINS; i++) {
+    abandon_bin_list(bins[i], i);
+    abandon_bin_list(full_bins[i], i);
+    bins[i] = NULL;
+    full_bins[i] = NULL;
+    empty_bins[i] = NULL;
+  }
+
+  owner->next = owner_pool;
+  owner_pool = owner;
+  pthread_mutex_unlock(&bin_lock);
+
+  thread_owner = NULL;
+}
+
+// Sets up the state shared by the bins of all threads
+static void init_bins() {
+  pthread_key_create(&owner_key, abandon_bins);
+
+  for (size_t i = 0; i < NUM_BINS; i++) {
+    span_shifts[i] = calculate_span_shift(i);
+  }
+}
+
+// Creates the owner for the current thread. It is only called once per thread
+static DMALLOC_NOINLINE Owner *new_owner() {
+  pthread_once(&owner_key_once, init_bins);
+
+  pthread_mutex_lock(&bin_lock);
+  if (owner_pool == NULL) {
+    // Carve a page up into owners
+    MmapAllocation allocation = retrieve_page(NULL);
+    if (__builtin_expect(allocation.ptr == NULL, 0)) {
+      pthread_mutex_unlock(&bin_lock);
+      return NULL;
+    }
+
+    Owner *owners = allocation.ptr;
+    size_t num_owners = allocation.size / sizeof(Owner);
+    for (size_t i = 0; i < num_owners; i++) {
+      owners[i].next = owner_pool;
+      owner_pool = &owners[i];
+    }
+  }
+
+  Owner *owner = owner_pool;
+  owner_pool = owner->next;
+  pthread_mutex_unlock(&bin_lock);
+
+  atomic_init(&owner->remote_frees, 0);
+  owner->next = NULL;
+
+  // Register the owner so the bins are abandoned when the thread exits. The
+  // owner is set first since registering it can allocate memory
+  thread_owner = owner;
+  pthread_setspecific(owner_key, owner);
+
+  return owner;
+}
+
+// Adopts a bin of an exited thread into the current thread. It is added to
+// the full bins if it has no free blocks
+static Bin *adopt_bin(size_t index, Owner *owner) {
+  // Fast path: avoid the lock if there is nothing to adopt
+  if (atomic_load_explicit(&abandoned_bins[index], memory_order_relaxed) ==
+      NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&bin_lock);
+  Bin *bin = atomic_load_explicit(&abandoned_bins[index], memory_order_relaxed);
+  if (bin != NULL) {
+    atomic_store_explicit(&abandoned_bins[index], bin->next,
+                          memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&bin_lock);
+
+  if (bin == NULL) {
+    return NULL;
+  }
+
+  atomic_store_explicit(&bin->owner, owner, memory_order_release);
+  push_bin(bin);
+  collect_remote_frees(bin);
+
+  return bin;
+}
+
+// Takes the blocks freed by other threads into a list of bins of the current
+// thread. Empty bins are returned to the store
+static void collect_list_remote_frees(Bin *bin) {
+  while (bin) {
+    // full bins that get blocks back move to the other list
+    Bin *next = bin->next;
+
+    if (collect_remote_frees(bin) && is_bin_empty(bin)) {
+      retire_empty_bin(bin);
+    }
+
+    bin = next;
+  }
 }
 
-// Allocates memory to the passed in bin
-static inline void *allocate_mem_to_bin(Bin *bin) {
+// Takes the blocks freed by other threads into the bins of the current
+// thread. Empty bins are returned to the store
+static void collect_all_remote_frees(size_t index) {
+  collect_list_remote_frees(bins[index]);
+  collect_list_remote_frees(full_bins[index]);
+  release_unused_kept_bin(index);
+}
+
+// Allocates memory to the passed in bin. zeroed is set to whether the memory
+// is known to be zero
+static inline void *allocate_mem_to_bin(Bin *bin, bool *zeroed) {
   // Fast path: check if bin has free blocks
   if (__builtin_expect(bin->free_blocks == 0, 0)) {
     return NULL;
   }
 
+#ifdef BIN_FREE_LIST
+  // Freed blocks are reused first, most recently freed first
+  void *block = bin->free_list;
+  count_allocated_blocks(bin, 1);
+  if (block != NULL) {
+    bin->free_list = *(void **)block;
+    *zeroed = false;
+    return block;
+  }
+
+  // Otherwise the next block that was never handed out is taken
+  size_t index = bin->bump++;
+  *zeroed = index >= bin->untouched;
+  if (*zeroed) {
+    bin->untouched = index + 1;
+  }
+
+  return (void *)((char *)bin->ptr + index * bin->bin_size);
+#else
   // Find first free available slot
   ssize_t index = find_first_unmarked_bit(&bin->bitset);
 
   // If no free slot found, return NULL
   if (__builtin_expect(index == -1, 0)) {
-    bin->free_blocks = 0; // Update cache
+    // The count is out of date, the bin is full
+    bin->free_blocks = 0;
+    move_bin(bin, true);
     return NULL;
   }
 
   // Mark block as used
   mark_bit(&bin->bitset, index);
-  bin->free_blocks--;
+  count_allocated_blocks(bin, 1);
+
+  // Blocks are handed out lowest first so every block past the highest one
+  // handed out so far is untouched
+  *zeroed = (size_t)index >= bin->untouched;
+  if (*zeroed) {
+    bin->untouched = index + 1;
+  }
 
   // Calculate and return pointer to the allocated memory block
   return (void *)((char *)bin->ptr + index * bin->bin_size);
+#endif
 }
 
-void *bin_alloc(size_t size) {
+// Allocates memory from the bins of the current thread. zeroed is set to
+// whether the memory is known to be zero
+static inline void *allocate_from_bins(size_t size, bool *zeroed) {
   // Fast path: determine bin index using optimized function
   size_t index = bin_index(size);
 
-  // Try recent bin first for better cache locality
-  Bin *recent = recent_bins[index];
-  if (__builtin_expect(recent != NULL && recent->free_blocks > 0, 1)) {
-    void *ptr = allocate_mem_to_bin(recent);
+  // Every bin in the list has free blocks so the first one is used
+  Bin *bin = bins[index];
+  if (__builtin_expect(bin != NULL, 1)) {
+    void *ptr = allocate_mem_to_bin(bin, zeroed);
     if (__builtin_expect(ptr != NULL, 1)) {
       return ptr;
     }
   }
 
-  // Get the head bin for this size
-  Bin *current = bins[index];
-  Bin *best_bin = NULL;
-  size_t best_free_count = 0;
-
-  // Search for a bin with available space
-  if (current != NULL) {
-    // Prefetch the bitset data to reduce cache misses
-    __builtin_prefetch(&current->bitset, 0, 3);
-
-    // Try up to 3 bins to balance search cost vs. fragmentation
-    int bin_count = 0;
-    while (current && bin_count < 3) {
-      // Use cached free count for faster decision making
-      if (current->free_blocks > 0 && current->free_blocks > best_free_count) {
-        best_bin = current;
-        best_free_count = current->free_blocks;
-
-        // If we find a bin with lots of free space, use it immediately
-        if (best_free_count > (current->bitset.num_bits / 4)) {
-          break;
-        }
-      }
+  Owner *owner = thread_owner;
+  if (__builtin_expect(owner == NULL, 0)) {
+    owner = new_owner();
+    if (owner == NULL) {
+      return NULL; // Out of memory
+    }
+  }
 
-      // Prefetch the next bin
-      if (current->next) {
-        __builtin_prefetch(&current->next->bitset, 0, 3);
-      }
+  // Reclaim memory freed by other threads before mapping more
+  if (atomic_load_explicit(&owner->remote_frees, memory_order_relaxed) != 0 &&
+      atomic_exchange_explicit(&owner->remote_frees, 0, memory_order_relaxed)) {
+    for (size_t i = 0; i < NUM_BINS; i++) {
+      collect_all_remote_frees(i);
+    }
+  }
 
-      current = current->next;
-      bin_count++;
+  // Bins of exited threads are reused before new memory is mapped
+  while (bins[index] == NULL && adopt_bin(index, owner) != NULL) {
+  }
+
+  bin = bins[index];
+  if (bin == NULL) {
+    // All bins are full, allocate a new one
+    bool span_zeroed;
+    MmapAllocation allocation =
+        retrieve_span(span_shifts[index], &span_zeroed);
+    if (__builtin_expect(allocation.ptr == NULL, 0)) {
+      return NULL; // Out of memory
     }
 
-    // If we found a bin with free space, allocate from it
-    if (best_bin) {
-      void *ptr = allocate_mem_to_bin(best_bin);
-      if (ptr) {
-        // Update recent bin cache
-        recent_bins[index] = best_bin;
-        return ptr;
-      }
+    // Every page of the span is recorded in the page map so that the bin can
+    // be found from any pointer into it
+    if (!page_map_set(allocation.ptr, allocation.size / PAGE_SIZE,
+                      BIN_ALLOCATION_TYPE, allocation.ptr)) {
+      store_span(allocation);
+      return NULL; // Out of memory
     }
-  }
 
-  // No available bins or all bins are full, allocate a new one
-  MmapAllocation allocation = retrieve_page();
-  if (__builtin_expect(allocation.ptr == NULL, 0)) {
-    return NULL; // Out of memory
+    // Initialize the new bin and insert it at the head of the list
+    bin = (Bin *)allocation.ptr;
+    init_bin(bin, index, owner, allocation, span_zeroed);
+    STAT_ADD(bins_created, 1);
+    push_bin(bin);
   }
 
-  // Initialize the new bin
-  Bin *bin = (Bin *)allocation.ptr;
-  size_t bin_size = calculate_bin_size(index);
-  init_bin(bin, bin_size, allocation);
+  // Allocate from the new bin
+  return allocate_mem_to_bin(bin, zeroed);
+}
 
-  // Insert at the head of the list
-  bin->next = bins[index];
-  bin->prev = NULL;
-  if (bins[index] != NULL) {
-    bins[index]->prev = bin;
+void *bin_alloc(size_t size) {
+  bool zeroed;
+  return allocate_from_bins(size, &zeroed);
+}
+
+void *bin_calloc(size_t size) {
+  bool zeroed;
+  void *ptr = allocate_from_bins(size, &zeroed);
+  if (ptr != NULL && !zeroed) {
+    memset(ptr, 0, size);
   }
-  bins[index] = bin;
 
-  // Update recent bin cache
-  recent_bins[index] = bin;
+  return ptr;
+}
 
-  // Allocate from the new bin
-  return allocate_mem_to_bin(bin);
+// Pushes a chain of count linked blocks onto the remote free queue of a bin
+// owned by another thread
+static void remote_free(void *first, void *last, size_t count, Bin *bin,
+                        Owner *owner) {
+  void *head = atomic_load_explicit(&bin->remote_frees, memory_order_relaxed);
+  do {
+    *(void **)last = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &bin->remote_frees, &head, first, memory_order_release,
+      memory_order_relaxed));
+
+  // Let the owner know there is memory to collect. Owners are never unmapped
+  // so this is safe even if the owner has exited in the meantime
+  if (owner != NULL) {
+    atomic_fetch_add_explicit(&owner->remote_frees, count,
+                              memory_order_relaxed);
+  }
 }
 
 // Takes a pointer to memory to free as well as the bin which it belongs to
 void bin_free(void *ptr, Bin *bin) {
-  // Fast path: calculate index of the allocation
-  size_t index = ((char *)ptr - (char *)bin->ptr) / bin->bin_size;
+  STAT_ADD(bin_frees[bin->index], 1);
 
-  // Unmark the bit in the bitset
-  unmark_bit(&bin->bitset, index);
-  bin->free_blocks++;
+  // Memory that belongs to another thread is queued for its owner
+  Owner *owner = atomic_load_explicit(&bin->owner, memory_order_acquire);
+  if (__builtin_expect(owner != thread_owner || owner == NULL, 0)) {
+    remote_free(ptr, ptr, 1, bin, owner);
+    return;
+  }
+
+  free_mem_in_bin(ptr, bin);
 
   // Check if bin is now empty
   if (__builtin_expect(is_bin_empty(bin), 0)) {
-    size_t bin_index_val = bin_index(bin->bin_size);
+    size_t index = bin->index;
+    retire_empty_bin(bin);
+    release_unused_kept_bin(index);
+  }
+}
+
+#ifdef BIN_FREE_LIST
+// Allocates up to n blocks from a bin, first from the freed blocks and then
+// from the blocks that were never handed out. Returns the number of blocks
+// that were allocated
+static size_t allocate_run_from_bin(Bin *bin, size_t n, void **out) {
+  size_t count = n < bin->free_blocks ? n : bin->free_blocks;
+  count_allocated_blocks(bin, count);
+
+  size_t i = 0;
+  void *block = bin->free_list;
+  for (; i < count && block != NULL; i++) {
+    out[i] = block;
+    block = *(void **)block;
+  }
+  bin->free_list = block;
+
+  // The remaining blocks are consecutive
+  char *next = (char *)bin->ptr + bin->bump * bin->bin_size;
+  bin->bump += count - i;
+  for (; i < count; i++) {
+    out[i] = next;
+    next += bin->bin_size;
+  }
 
-    // Clear from recent cache if it's there
-    if (recent_bins[bin_index_val] == bin) {
-      recent_bins[bin_index_val] = bin->next;
+  if (bin->bump > bin->untouched) {
+    bin->untouched = bin->bump;
+  }
+
+  return count;
+}
+#else
+// Allocates up to n blocks from a bin a bitset word at a time. Returns the
+// number of blocks that were allocated
+static size_t allocate_run_from_bin(Bin *bin, size_t n, void **out) {
+  size_t indices[BITS_PER_WORD];
+  size_t count = 0;
+
+  while (count < n && bin->free_blocks > 0) {
+    size_t max = n - count < BITS_PER_WORD ? n - count : BITS_PER_WORD;
+    size_t claimed = mark_unmarked_bits(&bin->bitset, max, indices);
+    if (__builtin_expect(claimed == 0, 0)) {
+      // The count is out of date, the bin is full
+      bin->free_blocks = 0;
+      move_bin(bin, true);
+      break;
     }
+    count_allocated_blocks(bin, claimed);
 
-    // Remove bin from the linked list
-    if (bin->prev == NULL) {
-      // This bin is the head
-      bins[bin_index_val] = bin->next;
-      if (bin->next != NULL) {
-        bin->next->prev = NULL;
-      }
-    } else {
-      // This bin is in the middle or end of the list
-      bin->prev->next = bin->next;
-      if (bin->next != NULL) {
-        bin->next->prev = bin->prev;
+    for (size_t i = 0; i < claimed; i++) {
+      out[count++] = (char *)bin->ptr + indices[i] * bin->bin_size;
+    }
+
+    // The blocks are claimed lowest first so the last one is the highest
+    if (indices[claimed - 1] >= bin->untouched) {
+      bin->untouched = indices[claimed - 1] + 1;
+    }
+  }
+
+  return count;
+}
+#endif
+
+size_t bin_alloc_batch(size_t size, size_t n, void **out) {
+  size_t index = bin_index(size);
+  size_t count = 0;
+
+  while (count < n) {
+    // A regular allocation finds or creates a bin with free blocks, the
+    // rest of the free blocks of the first bin are then claimed
+    void *ptr = bin_alloc(size);
+    if (__builtin_expect(ptr == NULL, 0)) {
+      break; // Out of memory
+    }
+    out[count++] = ptr;
+
+    Bin *bin = bins[index];
+    if (bin != NULL && count < n) {
+      count += allocate_run_from_bin(bin, n - count, out + count);
+    }
+  }
+
+  return count;
+}
+
+size_t bin_free_batch(Bin *bin, void **ptrs, size_t n) {
+  // Only the pointers at the start that belong to the bin are freed
+  size_t count = 1;
+  while (count < n && ptrs[count] != NULL &&
+         mmap_contains_ptr(bin->mmap_allocation, ptrs[count])) {
+    count++;
+  }
+  STAT_ADD(bin_frees[bin->index], count);
+
+  // Memory that belongs to another thread is queued for its owner as a
+  // single chain
+  Owner *owner = atomic_load_explicit(&bin->owner, memory_order_acquire);
+  if (__builtin_expect(owner != thread_owner || owner == NULL, 0)) {
+    for (size_t i = 0; i + 1 < count; i++) {
+      *(void **)ptrs[i] = ptrs[i + 1];
+    }
+    remote_free(ptrs[0], ptrs[count - 1], count, bin, owner);
+    return count;
+  }
+
+#ifdef BIN_FREE_LIST
+  // The blocks are linked together and put on the free list at once
+  for (size_t i = 0; i + 1 < count; i++) {
+    *(void **)ptrs[i] = ptrs[i + 1];
+  }
+  *(void **)ptrs[count - 1] = bin->free_list;
+  bin->free_list = ptrs[0];
+#else
+  // The bits of blocks in the same bitset word are cleared together
+  size_t word_idx = SIZE_MAX;
+  WORD mask = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t offset = (char *)ptrs[i] - (char *)bin->ptr;
+    size_t index = (offset * bin->reciprocal) >> 32;
+
+    if (index / BITS_PER_WORD != word_idx) {
+      if (mask != 0) {
+        unmark_bits(&bin->bitset, word_idx, mask);
       }
+      word_idx = index / BITS_PER_WORD;
+      mask = 0;
     }
+    mask |= (WORD)1 << (index % BITS_PER_WORD);
+  }
+  unmark_bits(&bin->bitset, word_idx, mask);
+#endif
+  count_freed_blocks(bin, count);
 
-    // Return the page to the store
-    store_page(bin->mmap_allocation);
+  // Check if bin is now empty
+  if (__builtin_expect(is_bin_empty(bin), 0)) {
+    size_t index = bin->index;
+    retire_empty_bin(bin);
+    release_unused_kept_bin(index);
   }
+
+  return count;
+}
+
+void bin_free_sized(void *ptr, size_t size) {
+  // Spans are aligned to their size so the bin is found from the size class
+  // without looking the pointer up
+  size_t span_size = PAGE_SIZE << span_shifts[bin_index(size)];
+  Bin *bin = (Bin *)((uintptr_t)ptr & ~(span_size - 1));
+
+  bin_free(ptr, bin);
 }
 
 size_t bin_size(Bin *bin) { return bin->bin_size; }
 
-Bin *allocated_by_bin(void *ptr) {
-  // Calculate the page start address for faster comparison
-  void *page_start = calculate_page_start(ptr);
-  
-  // If not found via direct check, search through all bins
-  // Start with smaller bins as they're more common
-  for (size_t i = 0; i < NUM_BINS; i++) {
-    Bin *current = bins[i];
-    
-    while (current) {
-      // Check if the pointer is within this bin's memory range
-      if (mmap_contains_ptr(current->mmap_allocation, ptr)) {
-        return current;
-      }
-      current = current->next;
+size_t bin_aligned_size(size_t alignment, size_t size) {
+  if (size > MAX_BIN_SIZE) {
+    return 0;
+  }
+
+  // every block of a class is aligned to the powers of two dividing its size
+  for (size_t index = bin_index(size); index < NUM_BINS; index++) {
+    size_t block_size = calculate_bin_size(index);
+    if (calculate_block_alignment(block_size) >= alignment) {
+      return block_size;
     }
   }
-  
-  return NULL;
+
+  return 0;
+}
+
+Bin *allocated_by_bin(void *ptr) {
+  PageOwner page_owner = page_map_get(ptr);
+  if (page_owner.owner == NULL || page_owner.type != BIN_ALLOCATION_TYPE) {
+    return NULL;
+  }
+
+  return page_owner.owner;
 }
 
 size_t num_bins() { return NUM_BINS; }
+
+void bin_lock_all() { pthread_mutex_lock(&bin_lock); }
+
+void bin_unlock_all() { pthread_mutex_unlock(&bin_lock); }
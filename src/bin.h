@@ -2,16 +2,75 @@
 #define BIN_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "allocator.h"
 #include "bitset.h"
 
-// The number of bins that we want
-#ifndef NUM_BINS
-#define NUM_BINS 8
+// The number of other bins of a size class that can become empty while the
+// kept empty bin stays empty before the kept bin is returned to the store
+#ifndef EMPTY_BIN_RETIRES
+#define EMPTY_BIN_RETIRES 32
 #endif
 
-// the maximum sized allocation that can fit into a bin
-#define MAX_BIN_SIZE (1 << (NUM_BINS - 1))
+// the maximum sized allocation that can fit into a bin, it must be the size
+// of a size class
+#ifndef MAX_BIN_SIZE
+#define MAX_BIN_SIZE 1024
+#endif
+
+// Size classes are BIN_QUANTUM bytes and then multiples of MIN_ALIGNMENT up
+// to BIN_LINEAR_MAX so that every block larger than BIN_QUANTUM is aligned to
+// MIN_ALIGNMENT. After that every doubling of the size is split into
+// 2^BIN_STEPS_LOG2 evenly spaced size classes so that at most a fifth of a
+// block is wasted. BIN_QUANTUM can not be smaller than a pointer since free
+// blocks hold a link to the next
+#define BIN_QUANTUM 8
+#define BIN_LINEAR_MAX 64
+#define BIN_LINEAR_LOG2 6
+#define BIN_LINEAR_CLASSES (BIN_LINEAR_MAX / MIN_ALIGNMENT + 1)
+#define BIN_STEPS_LOG2 2
+#define BIN_STEPS (1 << BIN_STEPS_LOG2)
+
+// floor(log2(x)) of a size larger than BIN_LINEAR_MAX that is also a constant
+// expression if x is
+#define BIN_LOG2(x) (63 - __builtin_clzll((unsigned long long)(x) | BIN_LINEAR_MAX))
+
+// The index of the size class that fits size bytes
+#define BIN_CLASS_INDEX(size)                                                  \
+  ((size) <= BIN_QUANTUM                                                       \
+       ? 0                                                                     \
+   : (size) <= BIN_LINEAR_MAX                                                  \
+       ? ((size) + MIN_ALIGNMENT - 1) / MIN_ALIGNMENT                          \
+       : BIN_LINEAR_CLASSES +                                                  \
+             ((BIN_LOG2((size) - 1) - BIN_LINEAR_LOG2) << BIN_STEPS_LOG2) +    \
+             ((((size) - 1) >> (BIN_LOG2((size) - 1) - BIN_STEPS_LOG2)) &      \
+              (BIN_STEPS - 1)))
+
+// The size of the blocks of the size class with the index
+#define BIN_CLASS_SIZE(index)                                                  \
+  ((index) == 0                                                                \
+       ? (size_t)BIN_QUANTUM                                                   \
+   : (index) < BIN_LINEAR_CLASSES                                              \
+       ? (size_t)(index) * MIN_ALIGNMENT                                       \
+       : ((size_t)BIN_LINEAR_MAX                                               \
+          << (((index) - BIN_LINEAR_CLASSES) >> BIN_STEPS_LOG2)) /             \
+             BIN_STEPS *                                                       \
+             (BIN_STEPS + ((index) - BIN_LINEAR_CLASSES) % BIN_STEPS + 1))
+
+// The number of bins (size classes) that we want
+#define NUM_BINS (BIN_CLASS_INDEX(MAX_BIN_SIZE) + 1)
+
+// The number of objects a bin should hold. Bins span as many pages as needed
+// (up to 2^MAX_SPAN_SHIFT) to fit this many objects
+#ifndef BIN_SPAN_OBJECTS
+#define BIN_SPAN_OBJECTS 256
+#endif
+
+// Bins find their free blocks with a bitset unless BIN_FREE_LIST is defined.
+// Then free blocks are linked into a list through the blocks themselves and
+// blocks that were never used are handed out by bumping an index, so both
+// allocating and freeing take constant time
+// #define BIN_FREE_LIST
 
 // Forward declaration since the implementor does not need to know the inner workings
 struct Bin;
@@ -19,15 +78,47 @@ struct Bin;
 // Allocators memory to a bin and returns a pointer to the bin
 DMALLOC_HOT DMALLOC_MALLOC void *bin_alloc(size_t size);
 
-// Frees memory from the bin containing the pointer
+// Allocates zeroed memory from a bin. Memory that was never used since its
+// span was mapped is not cleared again
+DMALLOC_HOT DMALLOC_MALLOC void *bin_calloc(size_t size);
+
+// Allocates n blocks of the same size and stores them in out. Whole runs of
+// free blocks are claimed at once. Returns the number of blocks allocated,
+// which is less than n if the system is out of memory
+DMALLOC_HOT size_t bin_alloc_batch(size_t size, size_t n, void **out);
+
+// Frees the pointers at the start of ptrs that belong to bin, which the first
+// one must. Returns the number of pointers that were freed
+DMALLOC_HOT size_t bin_free_batch(struct Bin *bin, void **ptrs, size_t n);
+
+// Frees memory from the bin containing the pointer. Memory freed by a thread
+// that does not own the bin is queued and reclaimed later by the owner
 DMALLOC_HOT void bin_free(void *ptr, struct Bin *bin);
 
+// Frees memory from a bin given the size that was requested for it instead
+// of the bin it belongs to
+DMALLOC_HOT void bin_free_sized(void *ptr, size_t size);
+
 // The size of blocks of memory that the bin allocates
 DMALLOC_PURE size_t bin_size(struct Bin *bin);
 
+// The smallest size class that can hold size bytes in blocks that are all
+// aligned to alignment, which must be a power of two. Returns 0 if no bin
+// has blocks that large and aligned
+DMALLOC_CONST size_t bin_aligned_size(size_t alignment, size_t size);
+
+// Returns the empty bins the current thread keeps that have been empty for
+// idle or more milliseconds at time now to the page store
+void bin_decay_empty_bins(uint32_t now, uint32_t idle);
+
+// Takes and releases the locks shared by the bins of all threads so that a
+// fork can not happen while another thread holds one
+void bin_lock_all();
+void bin_unlock_all();
+
 // Whether this memory pointed to by the provided ptr was allocated using
 // the bin allocator. If true return a pointer to the Bin in which it belongs if
-// false return null
+// false return null. This works for the bins of every thread
 DMALLOC_PURE struct Bin *allocated_by_bin(void *ptr);
 
 #endif
@@ -34,7 +34,52 @@ static inline size_t calculate_bit_idx(size_t index) {
 }
 
 static inline size_t size_of_bitset_words(size_t num_bits) {
-  return calculate_num_words(num_bits) * sizeof(WORD);
+  size_t num_words = calculate_num_words(num_bits);
+  return (num_words + calculate_num_words(num_words)) * sizeof(WORD);
+}
+
+// Gets the summary words which follow the words of the bitset
+static inline WORD *summary_words(BitSet *bitset) {
+  return bitset->words + bitset->num_words;
+}
+
+// Records that the word has unmarked bits
+static inline void mark_word_free(BitSet *bitset, size_t word_idx) {
+  summary_words(bitset)[calculate_word_idx(word_idx)] |=
+      (WORD)1 << calculate_bit_idx(word_idx);
+}
+
+// Records that all bits of the word are marked
+static inline void mark_word_full(BitSet *bitset, size_t word_idx) {
+  summary_words(bitset)[calculate_word_idx(word_idx)] &=
+      ~((WORD)1 << calculate_bit_idx(word_idx));
+}
+
+// Finds the index of the first word that is not zero or -1 if all are. The
+// bitset of a bin has at most 8 words and so a single summary word
+static inline ssize_t find_first_nonzero_word(const WORD *words,
+                                              size_t num_words) {
+  for (size_t i = 0; i < num_words; i++) {
+    if (words[i] != 0) {
+      return (ssize_t)i;
+    }
+  }
+
+  return -1;
+}
+
+// Finds the index of the first word with unmarked bits or -1 if all are full
+static inline ssize_t find_free_word(BitSet *bitset) {
+  WORD *summary = summary_words(bitset);
+
+  ssize_t summary_idx =
+      find_first_nonzero_word(summary, bitset->num_summary_words);
+  if (summary_idx < 0) {
+    return -1;
+  }
+
+  return (summary_idx << LOG2_BITS_PER_WORD) +
+         __builtin_ctzll(summary[summary_idx]);
 }
 
 size_t size_of_bitset(size_t num_bits) {
@@ -48,13 +93,12 @@ void init_bitset(BitSet *bitset, size_t num_bits) {
   // setting the number of words
   bitset->num_words = calculate_num_words(num_bits);
 
+  // every word needs a bit in the summary
+  bitset->num_summary_words = calculate_num_words(bitset->num_words);
+
   // setting the number of marked bits
   bitset->num_bits_marked = 0;
 
-  // since the bitset was just initialized the index of a word
-  // with free bits is the first one
-  bitset->free_word_index = 0;
-
   // setting the number of bits used in the last word of the bitset
   bitset->last_word_bits = num_bits % BITS_PER_WORD;
 
@@ -79,14 +123,9 @@ void mark_bit(BitSet *bitset, size_t index) {
     bitset->words[word_idx] |= bitmask;
     bitset->num_bits_marked++;
     
-    // Update free_word_index if this word becomes full
-    if (__builtin_expect(bitset->words[word_idx] == MAX_WORD_SIZE && word_idx == bitset->free_word_index, 0)) {
-      // Find next word with free bits
-      size_t next_free = word_idx + 1;
-      while (next_free < bitset->num_words && bitset->words[next_free] == MAX_WORD_SIZE) {
-        next_free++;
-      }
-      bitset->free_word_index = next_free;
+    // Update the summary if this word becomes full
+    if (__builtin_expect(bitset->words[word_idx] == MAX_WORD_SIZE, 0)) {
+      mark_word_full(bitset, word_idx);
     }
   }
 }
@@ -116,10 +155,8 @@ void unmark_bit(BitSet *bitset, size_t index) {
     bitset->words[word_idx] &= ~bitmask;
     bitset->num_bits_marked--;
     
-    // Update free_word_index if needed for faster future searches
-    if (word_idx < bitset->free_word_index) {
-      bitset->free_word_index = word_idx;
-    }
+    // The word has a free bit now
+    mark_word_free(bitset, word_idx);
   }
 }
 
@@ -143,10 +180,14 @@ void flip_bit(BitSet *bitset, size_t index) {
   WORD bitmask = (WORD)1 << bit_idx;
 
   bitset->words[word_idx] ^= bitmask;
-  if ((bitset->words[word_idx] & bitmask) == 1) {
+  if ((bitset->words[word_idx] & bitmask) != 0) {
     bitset->num_bits_marked++;
+    if (bitset->words[word_idx] == MAX_WORD_SIZE) {
+      mark_word_full(bitset, word_idx);
+    }
   } else {
     bitset->num_bits_marked--;
+    mark_word_free(bitset, word_idx);
   }
 }
 
@@ -164,57 +205,68 @@ bool check_bit(BitSet *bitset, size_t index) {
   return (bitset->words[word_idx] >> bit_idx) & 1;
 }
 
-// Optimized find_first_unmarked_bit using CPU intrinsics
+// Finds the first free word in the summary and the first free bit in that
+// word. Unused bits in the last word are always marked so they are never found
 ssize_t find_first_unmarked_bit(BitSet *bitset) {
-  // Start from the free_word_index for better cache locality
-  size_t start_word = bitset->free_word_index;
-  
-  // Fast path: check if we're already at the end
-  if (__builtin_expect(start_word >= bitset->num_words, 0)) {
+  ssize_t word_idx = find_free_word(bitset);
+  if (__builtin_expect(word_idx < 0, 0)) {
     return -1;
   }
-  
-  // Check words starting from free_word_index
-  for (size_t word_idx = start_word; word_idx < bitset->num_words; word_idx++) {
-    WORD word = bitset->words[word_idx];
-    
-    // Skip full words quickly
-    if (__builtin_expect(word == MAX_WORD_SIZE, 0)) {
-      continue;
+
+  WORD inverted_word = ~bitset->words[word_idx];
+  return (word_idx << LOG2_BITS_PER_WORD) + __builtin_ctzll(inverted_word);
+}
+
+size_t mark_unmarked_bits(BitSet *bitset, size_t max, size_t *indices) {
+  size_t count = 0;
+
+  while (count < max) {
+    ssize_t word_idx = find_free_word(bitset);
+    if (word_idx < 0) {
+      break;
     }
-    
-    // Handle last word specially to avoid checking unused bits
-    if (__builtin_expect(word_idx == bitset->num_words - 1 && bitset->last_word_bits != 0, 0)) {
-      // Mask out unused bits in the last word
-      WORD mask = ((WORD)1 << bitset->last_word_bits) - 1;
-      word |= ~mask; // Set unused bits to 1 (marked)
-      
-      if (word == MAX_WORD_SIZE) {
-        break; // No free bits in last word
-      }
+    WORD word = bitset->words[word_idx];
+
+    // Claim as many of the free bits of the word as are needed at once. The
+    // unused bits of the last word are always marked so they are never claimed
+    WORD free_bits = ~word;
+    WORD claimed = 0;
+    while (free_bits != 0 && count < max) {
+      WORD lowest = free_bits & -free_bits;
+      indices[count++] = word_idx * BITS_PER_WORD + __builtin_ctzll(free_bits);
+      claimed |= lowest;
+      free_bits ^= lowest;
     }
-    
-    // Use intrinsic to find first zero bit (unmarked bit)
-    WORD inverted_word = ~word;
-    unsigned int bit_pos = __builtin_ctzll(inverted_word);
-    
-    // Calculate final bit index
-    size_t bit_index = word_idx * BITS_PER_WORD + bit_pos;
-    
-    // Double-check we're not returning an invalid bit in the last word
-    if (__builtin_expect(bit_index >= bitset->num_bits, 0)) {
+
+    bitset->words[word_idx] = word | claimed;
+    bitset->num_bits_marked += __builtin_popcountll(claimed);
+
+    // Only move on once the word is full
+    if (bitset->words[word_idx] != MAX_WORD_SIZE) {
       break;
     }
-    
-    // Update free_word_index for next search
-    bitset->free_word_index = word_idx;
-    
-    return (ssize_t)bit_index;
+    mark_word_full(bitset, word_idx);
+  }
+
+  return count;
+}
+
+void unmark_bits(BitSet *bitset, size_t word_idx, WORD mask) {
+  // Only the bits that are marked are cleared
+  WORD marked = bitset->words[word_idx] & mask;
+
+  // Unused bits in the last word must stay marked
+  if (word_idx == bitset->num_words - 1 && bitset->last_word_bits != 0) {
+    marked &= ~unused_bit_mask(bitset->last_word_bits);
+  }
+
+  bitset->words[word_idx] &= ~marked;
+  bitset->num_bits_marked -= __builtin_popcountll(marked);
+
+  // The word has free bits now
+  if (marked != 0) {
+    mark_word_free(bitset, word_idx);
   }
-  
-  // No unmarked bits found
-  bitset->free_word_index = bitset->num_words;
-  return -1;
 }
 
 bool all_bits_marked(BitSet *bitset) {
@@ -234,10 +286,17 @@ void clear_bitset(BitSet *bitset) {
   if (bitset->last_word_bits != 0) {
     bitset->words[num_words - 1] = unused_bit_mask(bitset->last_word_bits);
   }
+
+  // every word has free bits, the bits after the last word stay unset
+  WORD *summary = summary_words(bitset);
+  memset(summary, 0xFF, bitset->num_summary_words * sizeof(WORD));
+  if (calculate_bit_idx(num_words) != 0) {
+    summary[bitset->num_summary_words - 1] =
+        ~unused_bit_mask(calculate_bit_idx(num_words));
+  }
   
   // Reset counters
   bitset->num_bits_marked = 0;
-  bitset->free_word_index = 0;
 }
 
 void print_bitset(BitSet *bitset) {
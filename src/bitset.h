@@ -16,11 +16,12 @@ typedef struct {
   size_t num_bits_marked;
   // The number number of bits in the last word that are used
   size_t last_word_bits;
-  // Keeps track of the last known word with free bits
-  size_t free_word_index;
   // The number of words in the bitset
   size_t num_words;
-  // The words in the bitset
+  // The number of summary words. Bit i of the summary is set while word i
+  // has unmarked bits so a free bit is found without scanning full words
+  size_t num_summary_words;
+  // The words in the bitset followed by the summary words
   WORD words[];
 } BitSet;
 
@@ -47,6 +48,13 @@ DMALLOC_PURE bool check_bit(BitSet *bitset, size_t index);
 // Finds the first occurence of an unmarked bit or -1 if none are found
 DMALLOC_HOT ssize_t find_first_unmarked_bit(BitSet *bitset);
 
+// Marks up to max unmarked bits, lowest first, a word at a time and stores
+// their indices. Returns the number of bits that were marked
+DMALLOC_HOT size_t mark_unmarked_bits(BitSet *bitset, size_t max, size_t *indices);
+
+// Clears the bits set in mask in the word at word_idx
+DMALLOC_HOT void unmark_bits(BitSet *bitset, size_t word_idx, WORD mask);
+
 // Prints the bitset to stdout
 DMALLOC_COLD void print_bitset(BitSet *bitset);
 
@@ -0,0 +1,159 @@
+#include "decay.h"
+#include "allocator.h"
+#include "bin.h"
+#include "huge.h"
+#include "page_store.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The coarse clock is read without a system call
+#ifdef CLOCK_MONOTONIC_COARSE
+#define DECAY_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define DECAY_CLOCK CLOCK_MONOTONIC
+#endif
+
+// The number of milliseconds memory stays cached before it is given back
+static atomic_uint decay_time = DECAY_TIME;
+
+// The purge thread, whether it is running and whether it was asked to stop
+static pthread_t purge_thread;
+static bool purge_running = false;
+static bool purge_stopping = false;
+
+// Protects the state of the purge thread and wakes it up to stop
+static pthread_mutex_t purge_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t purge_cond;
+static pthread_once_t purge_once = PTHREAD_ONCE_INIT;
+
+uint32_t decay_clock() {
+  struct timespec time;
+  clock_gettime(DECAY_CLOCK, &time);
+  return (uint32_t)time.tv_sec * 1000 + (uint32_t)(time.tv_nsec / 1000000);
+}
+
+size_t dmalloc_maintenance() {
+  uint32_t now = decay_clock();
+  uint32_t idle = atomic_load_explicit(&decay_time, memory_order_relaxed);
+  // the empty bins are returned to the store first so that they decay from
+  // there once they have been stored for the decay time too
+  bin_decay_empty_bins(now, idle);
+  return decay_page_store(now, idle) + decay_huge_cache(now, idle);
+}
+
+void dmalloc_set_decay_time(size_t milliseconds) {
+  // the clock wraps around after 2^32 milliseconds so longer times can not
+  // be told apart
+  if (milliseconds > INT32_MAX) {
+    milliseconds = INT32_MAX;
+  }
+  atomic_store_explicit(&decay_time, milliseconds, memory_order_relaxed);
+}
+
+// Gives back memory twice per decay time until asked to stop, so nothing
+// stays cached for much longer than the decay time
+static void *purge_loop(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&purge_lock);
+  while (!purge_stopping) {
+    uint32_t interval =
+        atomic_load_explicit(&decay_time, memory_order_relaxed) / 2;
+    if (interval == 0) {
+      interval = 1;
+    }
+
+    struct timespec wake;
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+    wake.tv_sec += interval / 1000;
+    wake.tv_nsec += (long)(interval % 1000) * 1000000;
+    if (wake.tv_nsec >= 1000000000) {
+      wake.tv_sec++;
+      wake.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&purge_cond, &purge_lock, &wake);
+    if (purge_stopping) {
+      break;
+    }
+
+    pthread_mutex_unlock(&purge_lock);
+    dmalloc_maintenance();
+    pthread_mutex_lock(&purge_lock);
+  }
+  pthread_mutex_unlock(&purge_lock);
+
+  return NULL;
+}
+
+// The purge thread does not exist in the child of a fork
+static void purge_postfork_child() {
+  pthread_mutex_init(&purge_lock, NULL);
+  purge_running = false;
+  purge_stopping = false;
+}
+
+static void init_purge_thread() {
+  // the thread waits on the monotonic clock so changes to the time of day
+  // do not affect it
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&purge_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  pthread_atfork(NULL, NULL, purge_postfork_child);
+}
+
+bool dmalloc_start_purge_thread() {
+  pthread_once(&purge_once, init_purge_thread);
+
+  pthread_mutex_lock(&purge_lock);
+  if (!purge_running) {
+    purge_stopping = false;
+    purge_running =
+        pthread_create(&purge_thread, NULL, purge_loop, NULL) == 0;
+  }
+  bool running = purge_running;
+  pthread_mutex_unlock(&purge_lock);
+
+  return running;
+}
+
+void dmalloc_stop_purge_thread() {
+  pthread_mutex_lock(&purge_lock);
+  if (!purge_running) {
+    pthread_mutex_unlock(&purge_lock);
+    return;
+  }
+  purge_stopping = true;
+  pthread_cond_signal(&purge_cond);
+  pthread_mutex_unlock(&purge_lock);
+
+  pthread_join(purge_thread, NULL);
+
+  pthread_mutex_lock(&purge_lock);
+  purge_running = false;
+  pthread_mutex_unlock(&purge_lock);
+}
+
+// The decay time can be set with DMALLOC_DECAY_TIME in milliseconds and the
+// purge thread is started if DMALLOC_PURGE_THREAD is set to anything other
+// than 0
+__attribute__((constructor)) static void init_decay() {
+  const char *value = getenv("DMALLOC_DECAY_TIME");
+  if (value != NULL && value[0] != '\0') {
+    char *end;
+    unsigned long long time = strtoull(value, &end, 10);
+    if (*end == '\0') {
+      dmalloc_set_decay_time(time);
+    }
+  }
+
+  value = getenv("DMALLOC_PURGE_THREAD");
+  if (value != NULL && value[0] != '\0' && value[0] != '0') {
+    dmalloc_start_purge_thread();
+  }
+}
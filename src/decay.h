@@ -0,0 +1,21 @@
+// This gives memory that has sat unused in the caches of the allocator for a
+// while back to the os, so that a long running program shrinks again after a
+// spike in load. Memory is only given back when dmalloc_maintenance is called
+// or from the purge thread, never on the path of an allocation or a free
+#ifndef DECAY_H
+#define DECAY_H
+
+#include <stdint.h>
+
+// The number of milliseconds a span or mapping stays cached before it is
+// given back by default. It can be changed with the DMALLOC_DECAY_TIME
+// environment variable or dmalloc_set_decay_time
+#ifndef DECAY_TIME
+#define DECAY_TIME 10000
+#endif
+
+// Gets the time in milliseconds on a coarse monotonic clock that is cheap to
+// read. It wraps around so only the difference between two times is meaningful
+uint32_t decay_clock();
+
+#endif
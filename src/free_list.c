@@ -1,48 +1,81 @@
 #include "free_list.h"
 #include "allocator.h"
 #include "mmap_allocator.h"
+#include "page_map.h"
 #include "page_store.h"
+#include "stats.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-// used to calculate the alignment of some variable
-#define ALIGNMENT 8
+// used to calculate the alignment of some variable. Block sizes are multiples
+// of it and blocks start right before an aligned address so that the memory
+// after their header is aligned
+#define ALIGNMENT MIN_ALIGNMENT
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
 
+// Free blocks are kept in buckets by size. Blocks smaller than
+// EXACT_BUCKETS * ALIGNMENT bytes get a bucket per size, after that every
+// doubling of the size is split into 2^BUCKET_STEPS_LOG2 buckets
+#define NUM_BUCKETS 64
+#define EXACT_BUCKETS 16
+#define EXACT_BUCKETS_LOG2 4
+#define BUCKET_STEPS_LOG2 2
+
+// The lower bits of a block size are always 0 because of the alignment so
+// they are used as flags. IN_USE is set if the block is allocated and
+// PREV_IN_USE if the block right before it in the chunk is allocated.
+// ZEROED is set on a free block whose memory is zero apart from its header
+// and footer because it was never allocated since its chunk was mapped
+#define IN_USE ((size_t)1)
+#define PREV_IN_USE ((size_t)2)
+#define ZEROED ((size_t)4)
+#define SIZE_FLAGS (IN_USE | PREV_IN_USE | ZEROED)
+
 // A header for a block of allocated memory
 typedef struct {
   // The amount of memory allocated for a block
-  // including the header
+  // including the header, combined with the flags
   size_t size;
 } AllocHeader;
 
-// A block of memory
+// A block of free memory. The last word of a free block is a footer holding
+// its size so that the block after it can find it in constant time
 typedef struct Block {
   // The amount of memory available that can be allocated
-  // this includes the memory that the block occupies
+  // this includes the memory that the block occupies, combined with the flags
   size_t size;
-  // Where the next free block is located
-  struct Block *next;
+  // The previous free block in the same bucket
+  struct Block *prev_in_bucket;
+  // The next free block in the same bucket
+  struct Block *next_in_bucket;
 } Block;
 
+// The smallest block that can be freed, it needs room for a footer
+#define MIN_BLOCK_SIZE (sizeof(Block) + sizeof(size_t))
+
+_Static_assert(MIN_BLOCK_SIZE % ALIGNMENT == 0,
+               "Splitting off a block must keep the blocks after it aligned");
+
 // A chunk of memory that can be further subdivided into blocks
 typedef struct Chunk {
   // Meta data about the kind of allocation
   AllocationHeader header;
   // The original allocation
   MmapAllocation mmap_allocation;
-  // The previous chunk of memory
-  struct Chunk *prev;
-  // The next chunk of memory
-  struct Chunk *next;
-  // Where the first free block of memory is
-  Block *block_head;
 } Chunk;
 
-// The head of the chunks
-static Chunk *chunk_head = NULL;
+// The free blocks of all chunks by size
+static Block *buckets[NUM_BUCKETS] = {[0 ... NUM_BUCKETS - 1] = NULL};
+
+// A bit is set for every bucket that is not empty
+static uint64_t bucket_bitmap = 0;
+
+// Protects the chunks since they are shared by all threads
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Returns an aligned memory address
 static inline void *alignment_forward(void *ptr, size_t alignment) {
@@ -52,193 +85,375 @@ static inline void *alignment_forward(void *ptr, size_t alignment) {
   return (void *)(p + padding);
 }
 
-// ***CHANGED***: Renamed for clarity and made robust with a NULL check.
-// Checks if the chunk has been fully coalesced into a single free block.
-static inline bool is_chunk_fully_coalesced(Chunk *chunk) {
-  // Calculate the total space that should be available for blocks.
-  void *first_block_ptr = alignment_forward((void *)(chunk + 1), ALIGNMENT);
-  size_t total_block_space = (uintptr_t)chunk + chunk->mmap_allocation.size -
-                             (uintptr_t)first_block_ptr;
+// The size of a block without the flags
+static inline size_t block_size(void *block) {
+  return ((Block *)block)->size & ~SIZE_FLAGS;
+}
+
+// The first block of a chunk, placed so that its memory is aligned
+static inline Block *first_block(Chunk *chunk) {
+  char *memory = (char *)(chunk + 1) + sizeof(AllocHeader);
+  return (Block *)((char *)alignment_forward(memory, ALIGNMENT) -
+                   sizeof(AllocHeader));
+}
+
+// The end of the memory of a chunk
+static inline char *chunk_end(Chunk *chunk) {
+  return (char *)chunk + chunk->mmap_allocation.size;
+}
+
+// Checks if the free block covers the whole chunk, meaning that nothing in the
+// chunk is allocated
+static inline bool is_chunk_fully_coalesced(Chunk *chunk, Block *block) {
+  return block == first_block(chunk) &&
+         (char *)block + block_size(block) == chunk_end(chunk);
+}
+
+// Calculates the bucket that a free block of size bytes belongs to
+static inline size_t bucket_index(size_t size) {
+  size_t granules = size / ALIGNMENT;
+  if (granules < EXACT_BUCKETS) {
+    return granules;
+  }
+
+  size_t log2 = 63 - __builtin_clzll(granules);
+  size_t step = (granules >> (log2 - BUCKET_STEPS_LOG2)) &
+                ((1 << BUCKET_STEPS_LOG2) - 1);
+  size_t index = EXACT_BUCKETS +
+                 ((log2 - EXACT_BUCKETS_LOG2) << BUCKET_STEPS_LOG2) + step;
+
+  return index < NUM_BUCKETS ? index : NUM_BUCKETS - 1;
+}
+
+// Adds a free block to its bucket
+static inline void insert_into_bucket(Block *block) {
+  size_t index = bucket_index(block_size(block));
+
+  block->prev_in_bucket = NULL;
+  block->next_in_bucket = buckets[index];
+  if (buckets[index] != NULL) {
+    buckets[index]->prev_in_bucket = block;
+  }
+  buckets[index] = block;
+
+  bucket_bitmap |= (uint64_t)1 << index;
+}
+
+// Removes a free block from its bucket
+static inline void remove_from_bucket(Block *block) {
+  if (block->prev_in_bucket != NULL) {
+    block->prev_in_bucket->next_in_bucket = block->next_in_bucket;
+  } else {
+    size_t index = bucket_index(block_size(block));
+    buckets[index] = block->next_in_bucket;
+    if (buckets[index] == NULL) {
+      bucket_bitmap &= ~((uint64_t)1 << index);
+    }
+  }
+
+  if (block->next_in_bucket != NULL) {
+    block->next_in_bucket->prev_in_bucket = block->prev_in_bucket;
+  }
+}
+
+// Finds a free block of at least size bytes or returns NULL
+static inline Block *find_block(size_t size) {
+  size_t index = bucket_index(size);
+
+  // Every block in a bucket after the one for the size is large enough so
+  // the first one found is a good fit
+  uint64_t larger = index + 1 < NUM_BUCKETS
+                        ? bucket_bitmap & ~(((uint64_t)2 << index) - 1)
+                        : 0;
+  if (larger != 0) {
+    return buckets[__builtin_ctzll(larger)];
+  }
 
-  // Check if there is exactly one block and it occupies all available space.
-  return chunk->block_head != NULL && chunk->block_head->next == NULL &&
-         chunk->block_head->size == total_block_space;
+  // The bucket of the size itself can hold blocks that are slightly too small
+  for (Block *block = buckets[index]; block; block = block->next_in_bucket) {
+    if (block_size(block) >= size) {
+      return block;
+    }
+  }
+
+  return NULL;
 }
 
-// initializes a Block
-static inline void init_block(Block *block, size_t size, Block *next) {
-  block->size = size;
-  block->next = next;
+// initializes a free Block and its footer. The block before a free block is
+// always allocated since free neighbours are coalesced
+static inline void init_block(Block *block, size_t size) {
+  block->size = size | PREV_IN_USE;
+  *(size_t *)((char *)block + size - sizeof(size_t)) = size;
 }
 
-// initializes and AllocHeader
+// initializes and AllocHeader keeping the PREV_IN_USE flag of the block
 static inline void init_alloc_header(AllocHeader *header, size_t size) {
-  header->size = size;
+  header->size = size | IN_USE | (header->size & PREV_IN_USE);
+}
+
+// Sets or clears the PREV_IN_USE flag of the block after a block if there is
+// one in the chunk
+static inline void set_next_prev_in_use(Chunk *chunk, void *block, size_t size,
+                                        bool in_use) {
+  char *next = (char *)block + size;
+  if (next < chunk_end(chunk)) {
+    if (in_use) {
+      ((Block *)next)->size |= PREV_IN_USE;
+    } else {
+      ((Block *)next)->size &= ~PREV_IN_USE;
+    }
+  }
 }
 
 // Allocates memory using mmap and creates a new chunk and initializes it
 static inline Chunk *new_chunk() {
-  MmapAllocation allocation = retrieve_page();
+  bool zeroed;
+  MmapAllocation allocation = retrieve_page(&zeroed);
+  if (__builtin_expect(allocation.ptr == NULL, 0)) {
+    return NULL;
+  }
+
   // this is the start of the chunk
   Chunk *chunk = (Chunk *)allocation.ptr;
-
-  // creating block head
-  uintptr_t chunk_end = (uintptr_t)((char *)allocation.ptr + allocation.size);
-  Block *block = (Block *)alignment_forward((void *)(chunk + 1), ALIGNMENT);
-  size_t block_size = chunk_end - (uintptr_t)block;
-  init_block(block, block_size, NULL);
+  if (__builtin_expect(!page_map_set(chunk, 1, FREE_LIST_ALLOCATION_TYPE, chunk),
+                       0)) {
+    store_page(allocation);
+    return NULL;
+  }
 
   *chunk = (Chunk){
       .header = FREE_LIST_ALLOCATION_TYPE,
       .mmap_allocation = allocation,
-      .prev = NULL,
-      .next = NULL,
-      .block_head = block,
   };
 
+  STAT_ADD(chunks_created, 1);
+
+  // the whole chunk starts as a single free block
+  Block *block = first_block(chunk);
+  init_block(block, chunk_end(chunk) - (char *)block);
+  if (zeroed) {
+    block->size |= ZEROED;
+  }
+  insert_into_bucket(block);
+
   return chunk;
 }
 
-// ***CHANGED***: Refactored to remove code duplication and fix logic bugs.
-void *free_list_alloc(size_t size) {
+// Allocates a block from the free list with its memory aligned to alignment.
+// If clear is set the memory is zeroed, which for a block that was never used
+// only needs its header to be cleared
+static inline void *allocate_block(size_t size, size_t alignment, bool clear) {
   // calculating the actual amount of memory that is needed
-  size = ALIGN(size);
-
-// Label to restart the search after creating a new chunk.
-start_search:;
-  Chunk *current_chunk = chunk_head;
-
-  while (current_chunk) {
-    Block *prev_block = NULL;
-    Block *current_block = current_chunk->block_head;
-
-    while (current_block) {
-      size_t total_size = sizeof(AllocHeader) + size;
-      if (current_block->size >= total_size) {
-        size_t remaining = current_block->size - total_size;
-
-        // ***FIXED***: The condition for splitting is now correct.
-        // A remaining fragment only needs to be large enough for a Block
-        // struct.
-        if (remaining >= sizeof(Block)) {
-          // Split the block
-          Block *new_block = (Block *)((char *)current_block + total_size);
-          init_block(new_block, remaining, current_block->next);
-
-          if (prev_block) {
-            prev_block->next = new_block;
-          } else {
-            current_chunk->block_head = new_block;
-          }
-
-          current_block->size = total_size; // Resize current block
-        } else {
-          // Use the whole block
-          total_size = current_block->size;
-
-          if (prev_block) {
-            prev_block->next = current_block->next;
-          } else {
-            current_chunk->block_head = current_block->next;
-          }
-        }
-
-        AllocHeader *header = (AllocHeader *)current_block;
-        init_alloc_header(header, total_size);
-        return (void *)(header + 1);
-      }
-
-      prev_block = current_block;
-      current_block = current_block->next;
-    }
+  size_t total_size = ALIGN(sizeof(AllocHeader) + size);
+
+  // a freed block must be able to hold its free list links and footer
+  if (total_size < MIN_BLOCK_SIZE) {
+    total_size = MIN_BLOCK_SIZE;
+  }
 
-    current_chunk = current_chunk->next;
+  // a larger alignment needs room to split off the front of a block
+  size_t search_size = total_size;
+  if (alignment > ALIGNMENT) {
+    search_size += alignment + MIN_BLOCK_SIZE;
   }
 
+  pthread_mutex_lock(&chunk_lock);
+
+  Block *block = find_block(search_size);
+
   // No suitable block found — create new chunk
-  Chunk *chunk = new_chunk();
-  chunk->next = chunk_head;
-  if (chunk_head != NULL) {
-    chunk_head->prev = chunk;
+  if (block == NULL) {
+    Chunk *chunk = new_chunk();
+    if (__builtin_expect(chunk == NULL, 0)) {
+      pthread_mutex_unlock(&chunk_lock);
+      return NULL;
+    }
+    block = first_block(chunk);
+  }
+
+  // chunks are a single page so the chunk is found from the page start
+  Chunk *chunk = calculate_page_start(block);
+  remove_from_bucket(block);
+  size_t zeroed = block->size & ZEROED;
+
+  // The memory before the aligned address becomes a free block of its own
+  char *memory = (char *)block + sizeof(AllocHeader);
+  char *aligned = alignment_forward(memory, alignment);
+  if (aligned != memory) {
+    if ((size_t)(aligned - memory) < MIN_BLOCK_SIZE) {
+      aligned = alignment_forward(memory + MIN_BLOCK_SIZE, alignment);
+    }
+    size_t leading = aligned - memory;
+    size_t size_left = block_size(block) - leading;
+
+    init_block(block, leading);
+    block->size |= zeroed;
+    insert_into_bucket(block);
+
+    // the block before the aligned block is now free
+    block = (Block *)((char *)block + leading);
+    block->size = size_left;
+  }
+
+  // A remaining fragment only needs to be large enough to be a free block
+  size_t remaining = block_size(block) - total_size;
+  if (remaining >= MIN_BLOCK_SIZE) {
+    // Split the block, the remainder stays free
+    Block *new_block = (Block *)((char *)block + total_size);
+    init_block(new_block, remaining);
+    new_block->size |= zeroed;
+    insert_into_bucket(new_block);
+  } else {
+    // Use the whole block
+    total_size = block_size(block);
+    set_next_prev_in_use(chunk, block, total_size, true);
+
+    // the footer is now part of the allocation
+    if (clear && zeroed) {
+      *(size_t *)((char *)block + total_size - sizeof(size_t)) = 0;
+    }
   }
-  chunk_head = chunk;
 
-  // ***REMOVED***: The duplicated allocation logic has been removed.
-  // Instead, we loop again. The new chunk is at the head and will be found
-  // instantly.
-  goto start_search;
+  pthread_mutex_unlock(&chunk_lock);
+
+  AllocHeader *header = (AllocHeader *)block;
+  init_alloc_header(header, total_size);
+  void *ptr = (void *)(header + 1);
+
+  STAT_ADD(free_list_allocs, 1);
+  STAT_ADD(free_list_alloc_bytes, total_size);
+
+  if (clear) {
+    // only the free list links of a zeroed block are not zero
+    size_t dirty = zeroed ? sizeof(Block) - sizeof(AllocHeader) : size;
+    memset(ptr, 0, dirty < size ? dirty : size);
+  }
+
+  return ptr;
+}
+
+void *free_list_alloc(size_t size) {
+  return allocate_block(size, ALIGNMENT, false);
+}
+
+void *free_list_calloc(size_t size) {
+  return allocate_block(size, ALIGNMENT, true);
+}
+
+void *free_list_aligned_alloc(size_t alignment, size_t size) {
+  return allocate_block(size, alignment, false);
 }
 
 void free_list_free(void *ptr, Chunk *chunk) {
   // first extract the header
   AllocHeader *header = (AllocHeader *)ptr - 1;
 
-  // we then iterate over the linked list to find first free block of memory
-  // just after the block that is to be deallocated
-  Block *current = chunk->block_head;
-  Block *previous = NULL;
+  pthread_mutex_lock(&chunk_lock);
 
-  // keep iterating until a block after the header is found
-  while (current && (uintptr_t)current < (uintptr_t)header) {
-    previous = current;
-    current = current->next;
-  }
+  Block *block = (Block *)header;
+  size_t size = block_size(header);
 
-  Block *new_block = (Block *)header;
+  STAT_ADD(free_list_frees, 1);
+  STAT_ADD(free_list_free_bytes, size);
 
-  // if current is NULL than header is at the end of the allocation
-  if (current == NULL) {
-    init_block(new_block, header->size, NULL);
-    if (previous) {
-      previous->next = new_block;
-    } else {
-      chunk->block_head = new_block;
-    }
-  }
-  // if current is right after the current header than the blocks can be
-  // coalesced
-  else if ((char *)header + header->size == (char *)current) {
-    init_block(new_block, header->size + current->size, current->next);
+  // if the block right after is free the blocks can be coalesced
+  Block *next = (Block *)((char *)header + size);
+  if ((char *)next < chunk_end(chunk) && !(next->size & IN_USE)) {
+    remove_from_bucket(next);
+    size += block_size(next);
   } else {
-    init_block(new_block, header->size, current);
+    set_next_prev_in_use(chunk, header, size, false);
   }
 
-  // if previous is NULL it means the block of memory to be deallocated is in
-  // the begining otherwise have previous point to the new block
-  if (previous) {
-    // if the previous block ends by the header coalesce it too
-    if ((char *)previous + previous->size == (char *)new_block) {
-      previous->size += new_block->size;
-      previous->next = new_block->next;
-    } else {
-      previous->next = new_block;
-    }
-  } else {
-    chunk->block_head = new_block;
+  // if the block right before is free its footer tells where it starts so it
+  // can be coalesced too
+  if (!(header->size & PREV_IN_USE)) {
+    size_t prev_size = *((size_t *)header - 1);
+    block = (Block *)((char *)header - prev_size);
+    remove_from_bucket(block);
+    size += prev_size;
   }
 
+  init_block(block, size);
+
   // if there is no allocated memory left return allocation to the store
-  // ***CHANGED***: Calls the safer, renamed function.
-  if (is_chunk_fully_coalesced(chunk)) {
-    // if the prev is null it is the head
-    if (chunk->prev == NULL) {
-      chunk_head = chunk->next;
-      if (chunk_head != NULL) {
-        chunk_head->prev = NULL;
-      }
-    } else {
-      chunk->prev->next = chunk->next;
-      // if there is a next
-      if (chunk->next != NULL) {
-        chunk->next->prev = chunk->prev;
-      }
-    }
+  if (is_chunk_fully_coalesced(chunk, block)) {
     // return the page to the store
+    STAT_ADD(chunks_released, 1);
+    page_map_clear(chunk, 1);
     store_page(chunk->mmap_allocation);
+  } else {
+    insert_into_bucket(block);
+  }
+
+  pthread_mutex_unlock(&chunk_lock);
+}
+
+bool free_list_resize(void *ptr, Chunk *chunk, size_t size) {
+  // calculating the actual amount of memory that is needed
+  size_t total_size = ALIGN(sizeof(AllocHeader) + size);
+  if (total_size < MIN_BLOCK_SIZE) {
+    total_size = MIN_BLOCK_SIZE;
+  }
+
+  AllocHeader *header = (AllocHeader *)ptr - 1;
+
+  pthread_mutex_lock(&chunk_lock);
+
+  // the block can grow into the block right after it if that one is free
+  size_t available = block_size(header);
+  Block *next = (Block *)((char *)header + available);
+  bool next_free = (char *)next < chunk_end(chunk) && !(next->size & IN_USE);
+  if (next_free) {
+    available += block_size(next);
+  }
+
+  if (available < total_size) {
+    pthread_mutex_unlock(&chunk_lock);
+    return false;
   }
+
+  if (next_free) {
+    remove_from_bucket(next);
+  }
+
+  // A remaining fragment only needs to be large enough to be a free block
+  size_t remaining = available - total_size;
+  if (remaining >= MIN_BLOCK_SIZE) {
+    // Split the block, the remainder becomes free
+    Block *new_block = (Block *)((char *)header + total_size);
+    init_block(new_block, remaining);
+    insert_into_bucket(new_block);
+    if (!next_free) {
+      set_next_prev_in_use(chunk, new_block, remaining, false);
+    }
+  } else {
+    // Use the whole block
+    total_size = available;
+    if (next_free) {
+      set_next_prev_in_use(chunk, header, total_size, true);
+    }
+  }
+
+  // the change in size is counted as memory allocated or freed
+  size_t old_size = block_size(header);
+  if (total_size > old_size) {
+    STAT_ADD(free_list_alloc_bytes, total_size - old_size);
+  } else {
+    STAT_ADD(free_list_free_bytes, old_size - total_size);
+  }
+
+  init_alloc_header(header, total_size);
+
+  pthread_mutex_unlock(&chunk_lock);
+  return true;
 }
 
 size_t free_list_size(void *ptr) {
   AllocHeader *header = (AllocHeader *)ptr - 1;
-  return header->size - sizeof(AllocHeader);
+  return block_size(header) - sizeof(AllocHeader);
 }
+
+void free_list_lock_all() { pthread_mutex_lock(&chunk_lock); }
+
+void free_list_unlock_all() { pthread_mutex_unlock(&chunk_lock); }
@@ -1,19 +1,41 @@
 #ifndef FREE_LIST_H
 #define FREE_LIST_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 struct Chunk;
 
 // Allocates memory to the free list.
-// It uses a first fit algorithm
+// Free blocks of all chunks are kept in buckets by size and the first block
+// of the smallest bucket that fits is used
 void *free_list_alloc(size_t size);
 
+// Allocates zeroed memory from the free list. Memory that was never used
+// since its chunk was mapped is not cleared again
+void *free_list_calloc(size_t size);
+
+// Allocates memory from the free list aligned to alignment, which must be a
+// power of two. The memory before the aligned address is split off as a free
+// block so it can still be used by other allocations
+void *free_list_aligned_alloc(size_t alignment, size_t size);
+
 // Deallocates memory from the free list
-// It requires the chunk to which the pointer belongs to be passed in alsoo
+// It requires the chunk to which the pointer belongs to be passed in alsoo.
+// Neighbouring free blocks are found and coalesced in constant time
 void free_list_free(void *ptr, struct Chunk *chunk);
 
+// Resizes memory from the free list without moving it by growing into the
+// free block right after it or by freeing the end of it.
+// Returns false if there is not enough free memory after the allocation
+bool free_list_resize(void *ptr, struct Chunk *chunk, size_t size);
+
 // Returns the size of the memory allocated for that object in the free list
 size_t free_list_size(void *ptr);
 
+// Takes and releases the lock of the chunks so that a fork can not happen
+// while another thread holds it
+void free_list_lock_all();
+void free_list_unlock_all();
+
 #endif
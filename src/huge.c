@@ -1,60 +1,393 @@
 // This is the implementation of the huge allocator
 
+// needed for mremap
+#define _GNU_SOURCE
+
 #include "allocator.h"
+#include "decay.h"
+#include "error.h"
 #include "mmap_allocator.h"
+#include "page_map.h"
+#include "stats.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "huge.h"
 
+// Recently freed mappings are kept in a cache so that allocations of the same
+// size can reuse them without a call to mmap and munmap. The largest mapping
+// that is cached, and the amount of memory the cache keeps mapped in total
+#ifndef HUGE_CACHE_MAX_MAPPING
+#define HUGE_CACHE_MAX_MAPPING ((size_t)32 << 20)
+#endif
+#ifndef HUGE_CACHE_SIZE
+#define HUGE_CACHE_SIZE ((size_t)128 << 20)
+#endif
+
+// The amount of memory in the cache whose pages are kept resident. The pages
+// of any further mappings are handed back to the os with madvise so that the
+// cache does not grow the resident set of the program
+#ifndef HUGE_CACHE_DIRTY_SIZE
+#define HUGE_CACHE_DIRTY_SIZE ((size_t)32 << 20)
+#endif
+
+// MADV_FREE lets the os reclaim the pages lazily which is cheaper when they
+// are reused before there is memory pressure
+#ifdef MADV_FREE
+#define PURGE_ADVICE MADV_FREE
+#else
+#define PURGE_ADVICE MADV_DONTNEED
+#endif
+
+// Cached mappings are kept in buckets by their number of pages. Mappings that
+// can be cached are rounded up so that every bucket holds a single size, with
+// 2^HUGE_STEPS_LOG2 sizes for every doubling of the number of pages
+#define NUM_HUGE_BUCKETS 64
+#define HUGE_STEPS_LOG2 2
+#define HUGE_STEPS (1 << HUGE_STEPS_LOG2)
+
 // This is the header for allocations from the huge allocator.
 // It is assumed this header is smalled than a page size
 // which it most likely will be
-typedef struct {
+typedef struct HugeHeader {
   // what kind of allocation this is
   AllocationHeader header;
   // the size of the allocation, this is the amount of memory needed not used
   size_t size;
+  // where the allocation starts relative to the header
+  size_t offset;
   // the mmap allocation details
   MmapAllocation mmap_allocation;
+  // the next mapping in the same bucket while the mapping is cached
+  struct HugeHeader *next;
+  // whether the pages of the mapping are resident while it is cached
+  bool dirty;
+  // when the mapping was cached, on the clock of decay_clock
+  uint32_t cached_at;
 } HugeHeader;
 
+// The cached mappings of every size
+static HugeHeader *buckets[NUM_HUGE_BUCKETS] = {[0 ... NUM_HUGE_BUCKETS - 1] = NULL};
+
+// The amount of memory held by the cache and how much of it is resident
+static size_t cached_bytes = 0;
+static size_t dirty_bytes = 0;
+
+// Protects the cache since it is shared by all threads
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // initializes the huge header
 // from a mmap allocation
-static inline void init_huge_header(HugeHeader *header, size_t size, MmapAllocation allocation) {
+static inline void init_huge_header(HugeHeader *header, size_t size,
+                                    size_t offset, MmapAllocation allocation) {
   *header = (HugeHeader){
     .header = HUGE_ALLOCATION_TYPE,
     .size = size,
+    .offset = offset,
     .mmap_allocation = allocation,
   };
 }
 
-void *huge_alloc(size_t size) {
+// Calculates the bucket for a mapping of num_pages pages and rounds num_pages
+// up to the size of the bucket
+static inline size_t bucket_index(size_t *num_pages) {
+  size_t pages = *num_pages;
+  if (pages <= HUGE_STEPS) {
+    return pages - 1;
+  }
+
+  // the pages lie in (2^log2, 2^(log2 + 1)] which is split into HUGE_STEPS
+  size_t log2 = 63 - __builtin_clzll(pages - 1);
+  size_t shift = log2 - HUGE_STEPS_LOG2;
+  size_t step = (pages - 1) >> shift;
+
+  *num_pages = (step + 1) << shift;
+  return HUGE_STEPS + (shift << HUGE_STEPS_LOG2) + step - HUGE_STEPS;
+}
+
+// Takes a mapping of the size of the bucket out of the cache or returns NULL
+static HugeHeader *retrieve_mapping(size_t index) {
+  pthread_mutex_lock(&cache_lock);
+
+  HugeHeader *header = buckets[index];
+  if (header != NULL) {
+    buckets[index] = header->next;
+
+    size_t size = header->mmap_allocation.size;
+    cached_bytes -= size;
+    if (header->dirty) {
+      dirty_bytes -= size;
+    }
+  }
+
+  pthread_mutex_unlock(&cache_lock);
+  return header;
+}
+
+// Puts a mapping in the cache. Returns false if the cache is full
+static bool store_mapping(HugeHeader *header) {
+  size_t size = header->mmap_allocation.size;
+  size_t num_pages = size / PAGE_SIZE;
+  if (size > HUGE_CACHE_MAX_MAPPING) {
+    return false;
+  }
+
+  // only mappings of exactly the size of their bucket can be reused
+  size_t index = bucket_index(&num_pages);
+  if (num_pages * PAGE_SIZE != size) {
+    return false;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+
+  if (cached_bytes + size > HUGE_CACHE_SIZE) {
+    pthread_mutex_unlock(&cache_lock);
+    return false;
+  }
+
+  cached_bytes += size;
+  header->dirty = dirty_bytes + size <= HUGE_CACHE_DIRTY_SIZE;
+  if (header->dirty) {
+    dirty_bytes += size;
+  } else if (size > PAGE_SIZE) {
+    // the pages are handed back before the mapping is in a bucket, after
+    // that another thread can take it and write to it. The first page is
+    // kept since it holds the header
+    pthread_mutex_unlock(&cache_lock);
+    madvise((char *)header + PAGE_SIZE, size - PAGE_SIZE, PURGE_ADVICE);
+    STAT_ADD(madvise_calls, 1);
+    pthread_mutex_lock(&cache_lock);
+  }
+
+  // the header must not be touched once it is in a bucket
+  header->cached_at = decay_clock();
+  header->next = buckets[index];
+  buckets[index] = header;
+
+  pthread_mutex_unlock(&cache_lock);
+
+  return true;
+}
+
+// Calculates where an allocation with the alignment starts relative to its
+// header. Alignments larger than a page leave the whole first aligned block
+// to the header, which only costs address space since it is never touched
+static inline size_t calculate_offset(size_t alignment) {
+  if (alignment > PAGE_SIZE) {
+    return alignment;
+  }
+
+  return (sizeof(HugeHeader) + alignment - 1) & ~(alignment - 1);
+}
+
+// Allocates a mapping for an allocation. If clear is set the memory is
+// zeroed, which only needs to be done for a reused mapping since fresh pages
+// from the os are always zero
+static inline void *allocate_mapping(size_t size, size_t alignment,
+                                     bool clear) {
   // figuring out how many pages are needed
   // since the allocation needs to also keep in mind
   // the sizeof the header
-  size_t num_pages = calculate_num_pages(size + sizeof(HugeHeader));
+  size_t offset = calculate_offset(alignment);
+
+  // the mapping, rounded up to whole pages and with room to align it, must
+  // not wrap around
+  size_t mapped_size;
+  if (__builtin_expect(
+          __builtin_add_overflow(size, offset + PAGE_SIZE, &mapped_size) ||
+              (alignment > PAGE_SIZE &&
+               __builtin_add_overflow(mapped_size, alignment, &mapped_size)),
+          0)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size_t num_pages = calculate_num_pages(size + offset);
 
-  // allocating pages
-  MmapAllocation allocation = mmap_alloc(num_pages);
+  // mappings that can be cached are rounded up to the size of their bucket
+  // so that they can be reused by any allocation in the same bucket. Every
+  // mapping is page aligned so only larger alignments need a new mapping
+  HugeHeader *header = NULL;
+  MmapAllocation allocation;
+  if (alignment <= PAGE_SIZE &&
+      num_pages * PAGE_SIZE <= HUGE_CACHE_MAX_MAPPING) {
+    size_t index = bucket_index(&num_pages);
+    header = retrieve_mapping(index);
+    if (header != NULL) {
+      STAT_ADD(huge_cache_hits, 1);
+    } else {
+      STAT_ADD(huge_cache_misses, 1);
+    }
+  }
+
+  bool reused = header != NULL;
+  if (reused) {
+    allocation = header->mmap_allocation;
+  } else {
+    // allocating pages
+    allocation = alignment > PAGE_SIZE
+                     ? mmap_alloc_aligned(num_pages, alignment)
+                     : mmap_alloc(num_pages);
+    if (__builtin_expect(allocation.ptr == MAP_FAILED, 0)) {
+      return NULL;
+    }
+    header = (HugeHeader *)allocation.ptr;
+  }
 
   // creating header
-  HugeHeader *header = (HugeHeader *)allocation.ptr;
-  init_huge_header(header, size, allocation);
+  init_huge_header(header, size, offset, allocation);
+
+  // every page is recorded so that the header is found from any pointer
+  if (__builtin_expect(!page_map_set(header, num_pages, HUGE_ALLOCATION_TYPE,
+                                     header),
+                       0)) {
+    mmap_free(allocation);
+    return NULL;
+  }
+
+  STAT_ADD(huge_allocs, 1);
+  STAT_ADD(huge_alloc_bytes, allocation.size - offset);
 
   // getting pointer to return
-  void *ptr = (void *)(header + 1);
+  void *ptr = (char *)header + offset;
+
+  if (clear && reused) {
+    memset(ptr, 0, size);
+  }
 
   return ptr;
 }
 
-void huge_free(void *ptr) {
-  // getting start of page and extracting the header 
-  HugeHeader *header = calculate_page_start(ptr);
+void *huge_alloc(size_t size) {
+  return allocate_mapping(size, MIN_ALIGNMENT, false);
+}
+
+void *huge_calloc(size_t size) {
+  return allocate_mapping(size, MIN_ALIGNMENT, true);
+}
+
+void *huge_aligned_alloc(size_t alignment, size_t size) {
+  return allocate_mapping(size, alignment, false);
+}
+
+void huge_free(HugeHeader *header) {
+  // the pages are no longer owned by the allocation even while cached
+  MmapAllocation allocation = header->mmap_allocation;
+  STAT_ADD(huge_frees, 1);
+  STAT_ADD(huge_free_bytes, allocation.size - header->offset);
+  page_map_clear(allocation.ptr, allocation.size / PAGE_SIZE);
+
+  // deallocating memory using the mmap_allocation if the cache is full
+  if (!store_mapping(header)) {
+    mmap_free(allocation);
+  }
+}
+
+void *huge_realloc(void *ptr, HugeHeader *header, size_t size) {
+  MmapAllocation allocation = header->mmap_allocation;
+
+  // the mapping rounded up to whole pages must not wrap around
+  size_t mapped_size;
+  if (__builtin_expect(__builtin_add_overflow(size, header->offset + PAGE_SIZE,
+                                              &mapped_size),
+                       0)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size_t num_pages = calculate_num_pages(size + header->offset);
+  size_t new_size = num_pages * PAGE_SIZE;
 
-  // deallocating memory using the mmap_allocation
-  mmap_free(header->mmap_allocation);
+  // the mapping is kept as is if it is large enough and not mostly unused
+  if (new_size <= allocation.size && new_size > allocation.size / 2) {
+    header->size = size;
+    return ptr;
+  }
+
+  // the os can move the pages so the old pages are forgotten first in case
+  // another thread maps them as soon as they are released
+  page_map_clear(allocation.ptr, allocation.size / PAGE_SIZE);
+  void *new_ptr =
+      mremap(allocation.ptr, allocation.size, new_size, MREMAP_MAYMOVE);
+  STAT_ADD(mremap_calls, 1);
+  if (__builtin_expect(new_ptr == MAP_FAILED, 0)) {
+    page_map_set(allocation.ptr, allocation.size / PAGE_SIZE,
+                 HUGE_ALLOCATION_TYPE, header);
+    return NULL;
+  }
+
+  // the whole mapping is counted as allocated
+  STAT_ADD(mapped_bytes, new_size);
+  STAT_ADD(unmapped_bytes, allocation.size);
+  STAT_ADD(huge_alloc_bytes, new_size);
+  STAT_ADD(huge_free_bytes, allocation.size);
+
+  header = (HugeHeader *)new_ptr;
+  header->size = size;
+  header->mmap_allocation = (MmapAllocation){
+      .size = new_size,
+      .ptr = new_ptr,
+  };
+
+  // the allocation would otherwise be lost
+  if (__builtin_expect(
+          !page_map_set(header, num_pages, HUGE_ALLOCATION_TYPE, header), 0)) {
+    out_of_memory_error();
+  }
+
+  return (char *)header + header->offset;
 }
 
 size_t huge_size(void *ptr) {
   HugeHeader *header = (HugeHeader *)ptr;  
   return header->size;
 }
+
+size_t huge_usable_size(HugeHeader *header) {
+  return header->mmap_allocation.size - header->offset;
+}
+
+size_t decay_huge_cache(uint32_t now, uint32_t idle) {
+  // the mappings are taken out of the cache first so that they are unmapped
+  // without holding the lock
+  HugeHeader *expired = NULL;
+
+  pthread_mutex_lock(&cache_lock);
+  for (size_t i = 0; i < NUM_HUGE_BUCKETS; i++) {
+    HugeHeader **link = &buckets[i];
+    while (*link != NULL) {
+      HugeHeader *header = *link;
+      if ((uint32_t)(now - header->cached_at) < idle) {
+        link = &header->next;
+        continue;
+      }
+
+      *link = header->next;
+      size_t size = header->mmap_allocation.size;
+      cached_bytes -= size;
+      if (header->dirty) {
+        dirty_bytes -= size;
+      }
+      header->next = expired;
+      expired = header;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  size_t released_bytes = 0;
+  while (expired != NULL) {
+    HugeHeader *next = expired->next;
+    released_bytes += expired->mmap_allocation.size;
+    mmap_free(expired->mmap_allocation);
+    expired = next;
+  }
+
+  return released_bytes;
+}
+
+void huge_lock_all() { pthread_mutex_lock(&cache_lock); }
+
+void huge_unlock_all() { pthread_mutex_unlock(&cache_lock); }
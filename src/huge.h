@@ -4,16 +4,46 @@
 #define HUGE_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+struct HugeHeader;
 
 // Allocates a large amount of memory of at least 1 page size
 void *huge_alloc(size_t size);
 
-// Deallocates a large amount of memory allocated by hugealloc
-void huge_free(void *ptr);
+// Allocates a large amount of zeroed memory. Fresh pages from the os are not
+// cleared again so they are not touched
+void *huge_calloc(size_t size);
+
+// Allocates a large amount of memory aligned to alignment, which must be a
+// power of two. Alignments larger than a page get a mapping aligned to them
+void *huge_aligned_alloc(size_t alignment, size_t size);
+
+// Deallocates a large amount of memory allocated by hugealloc given the
+// header of the allocation
+void huge_free(struct HugeHeader *header);
+
+// Resizes memory allocated by huge_alloc without copying it. The pages can be
+// moved by the os so the new location is returned, or NULL if the pages could
+// not be resized in which case the allocation is unchanged
+void *huge_realloc(void *ptr, struct HugeHeader *header, size_t size);
 
 // Retrieves the amount of memory allocated for this allocation
 // this is the amount of memory needed, not used.
 // It requires a page aligned pointer
 size_t huge_size(void *ptr);
 
+// Retrieves the amount of memory that can be used by this allocation, which
+// is the rest of its mapping
+size_t huge_usable_size(struct HugeHeader *header);
+
+// Unmaps the cached mappings that have been in the cache for idle or more
+// milliseconds at time now. Returns the number of bytes unmapped
+size_t decay_huge_cache(uint32_t now, uint32_t idle);
+
+// Takes and releases the lock of the mapping cache so that a fork can not
+// happen while another thread holds it
+void huge_lock_all();
+void huge_unlock_all();
+
 #endif
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <sys/mman.h>
 #include "stdint.h"
+#include "stats.h"
 
 size_t get_page_size() {
   static size_t size = 0;
@@ -23,15 +24,66 @@ MmapAllocation mmap_alloc(size_t num_pages) {
   void *ptr = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE,
                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
+  STAT_ADD(mmap_calls, 1);
+  if (ptr != MAP_FAILED) {
+    STAT_ADD(mapped_bytes, alloc_size);
+  }
+
   return (MmapAllocation){
       .size = alloc_size,
       .ptr = ptr,
   };
 }
 
+MmapAllocation mmap_alloc_aligned(size_t num_pages, size_t alignment) {
+  // getting the page size
+  size_t page_size = PAGE_SIZE;
+  // calculating how much memory will be allocated
+  size_t alloc_size = num_pages * page_size;
+
+  // page alignment is guaranteed by mmap
+  if (alignment <= page_size) {
+    return mmap_alloc(num_pages);
+  }
+
+  // allocating enough extra memory that an aligned region must fit
+  size_t mapped_size = alloc_size + alignment - page_size;
+  char *ptr = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  STAT_ADD(mmap_calls, 1);
+  if (ptr == MAP_FAILED) {
+    return (MmapAllocation){
+        .size = alloc_size,
+        .ptr = MAP_FAILED,
+    };
+  }
+
+  // trimming the memory before and after the aligned region
+  char *aligned = (char *)(((uintptr_t)ptr + alignment - 1) & ~(alignment - 1));
+  size_t head = aligned - ptr;
+  size_t tail = mapped_size - head - alloc_size;
+  if (head) {
+    munmap(ptr, head);
+    STAT_ADD(munmap_calls, 1);
+  }
+  if (tail) {
+    munmap(aligned + alloc_size, tail);
+    STAT_ADD(munmap_calls, 1);
+  }
+  STAT_ADD(mapped_bytes, alloc_size);
+
+  return (MmapAllocation){
+      .size = alloc_size,
+      .ptr = aligned,
+  };
+}
+
 void mmap_free(MmapAllocation alloc) {
   // deallocating memory
   munmap(alloc.ptr, alloc.size);
+
+  STAT_ADD(munmap_calls, 1);
+  STAT_ADD(unmapped_bytes, alloc.size);
 }
 
 size_t calculate_num_pages(size_t size) {
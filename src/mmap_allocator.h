@@ -28,6 +28,10 @@ typedef struct {
 // as the amount of memory allocated in bytes
 MmapAllocation mmap_alloc(size_t num_pages);
 
+// Allocates memory using mmap like mmap_alloc but the returned memory is
+// aligned to alignment bytes which must be a power of 2
+MmapAllocation mmap_alloc_aligned(size_t num_pages, size_t alignment);
+
 // Deallocates memory using mmap. It takes a struct containing the the pointer
 // to the memory as well as the amount of memory to deallocate in bytes
 void mmap_free(MmapAllocation alloc);
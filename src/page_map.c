@@ -0,0 +1,131 @@
+#include "page_map.h"
+#include "mmap_allocator.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// The map is a two level radix tree indexed by the page number of an address.
+// Pages are tracked at the smallest page size so the layout does not depend
+// on the page size of the os
+#define PAGE_MAP_SHIFT 12
+
+// The number of bits of an address that are used
+#define ADDRESS_BITS 48
+
+// The number of bits of the page number used to index each level
+#define LEAF_BITS 18
+#define ROOT_BITS (ADDRESS_BITS - PAGE_MAP_SHIFT - LEAF_BITS)
+
+#define LEAF_SIZE ((size_t)1 << LEAF_BITS)
+#define ROOT_SIZE ((size_t)1 << ROOT_BITS)
+
+// The allocation type is stored in the lower bits of the owner which are
+// always 0 because of its alignment. It is offset by 1 so that an empty entry
+// can be told apart from a bin
+#define TYPE_MASK ((uintptr_t)3)
+
+// A leaf of the map holding the owner of every page
+typedef struct {
+  _Atomic uintptr_t owners[LEAF_SIZE];
+} PageMapLeaf;
+
+// The root of the map. Leaves are only allocated once a page in their range
+// is recorded so most of this is never touched
+static _Atomic(PageMapLeaf *) root[ROOT_SIZE] = {0};
+
+// Calculates the index into the root
+static inline size_t root_index(uintptr_t page) {
+  return (page >> LEAF_BITS) & (ROOT_SIZE - 1);
+}
+
+// Calculates the index into a leaf
+static inline size_t leaf_index(uintptr_t page) {
+  return page & (LEAF_SIZE - 1);
+}
+
+// Gets the leaf for a page, allocating it if it does not exist yet
+static PageMapLeaf *get_or_create_leaf(uintptr_t page) {
+  _Atomic(PageMapLeaf *) *slot = &root[root_index(page)];
+  PageMapLeaf *leaf = atomic_load_explicit(slot, memory_order_acquire);
+  if (leaf != NULL) {
+    return leaf;
+  }
+
+  // mmap memory is zeroed so every page starts without an owner
+  MmapAllocation allocation =
+      mmap_alloc(calculate_num_pages(sizeof(PageMapLeaf)));
+  if (allocation.ptr == MAP_FAILED) {
+    return NULL;
+  }
+
+  // another thread could have created the leaf in the meantime
+  PageMapLeaf *expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(slot, &expected, allocation.ptr,
+                                               memory_order_acq_rel,
+                                               memory_order_acquire)) {
+    mmap_free(allocation);
+    return expected;
+  }
+
+  return allocation.ptr;
+}
+
+// Stores an entry for every page in the range. Returns false if a leaf could
+// not be allocated
+static bool store_entries(void *ptr, size_t num_pages, uintptr_t entry) {
+  uintptr_t first = (uintptr_t)ptr >> PAGE_MAP_SHIFT;
+  uintptr_t last = first + ((num_pages * PAGE_SIZE) >> PAGE_MAP_SHIFT);
+
+  for (uintptr_t page = first; page < last; page++) {
+    PageMapLeaf *leaf;
+    if (entry == 0) {
+      // nothing needs to be removed from a leaf that does not exist
+      leaf = atomic_load_explicit(&root[root_index(page)], memory_order_acquire);
+      if (leaf == NULL) {
+        continue;
+      }
+    } else {
+      leaf = get_or_create_leaf(page);
+      if (__builtin_expect(leaf == NULL, 0)) {
+        return false;
+      }
+    }
+
+    atomic_store_explicit(&leaf->owners[leaf_index(page)], entry,
+                          memory_order_relaxed);
+  }
+
+  return true;
+}
+
+bool page_map_set(void *ptr, size_t num_pages, AllocationType type,
+                  void *owner) {
+  uintptr_t entry = (uintptr_t)owner | ((uintptr_t)type + 1);
+  return store_entries(ptr, num_pages, entry);
+}
+
+void page_map_clear(void *ptr, size_t num_pages) {
+  store_entries(ptr, num_pages, 0);
+}
+
+PageOwner page_map_get(void *ptr) {
+  uintptr_t page = (uintptr_t)ptr >> PAGE_MAP_SHIFT;
+
+  PageMapLeaf *leaf =
+      atomic_load_explicit(&root[root_index(page)], memory_order_acquire);
+  if (leaf == NULL) {
+    return (PageOwner){0};
+  }
+
+  uintptr_t entry = atomic_load_explicit(&leaf->owners[leaf_index(page)],
+                                         memory_order_relaxed);
+  if (entry == 0) {
+    return (PageOwner){0};
+  }
+
+  return (PageOwner){
+      .type = (AllocationType)((entry & TYPE_MASK) - 1),
+      .owner = (void *)(entry & ~TYPE_MASK),
+  };
+}
@@ -0,0 +1,32 @@
+// This keeps track of which allocator and which allocation every page handed
+// out by dmalloc belongs to, so that the owner of any pointer can be found in
+// constant time
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "allocator.h"
+
+// The owner of a page
+typedef struct {
+  // The allocator the page belongs to
+  AllocationType type;
+  // The header of the allocation (Bin, Chunk or huge allocation) the page
+  // belongs to, NULL if the page does not belong to dmalloc
+  void *owner;
+} PageOwner;
+
+// Records owner as the header of the num_pages pages starting at ptr.
+// The owner must be at least 4 byte aligned.
+// Returns false if there is not enough memory for the map
+bool page_map_set(void *ptr, size_t num_pages, AllocationType type,
+                  void *owner);
+
+// Removes the num_pages pages starting at ptr from the map
+void page_map_clear(void *ptr, size_t num_pages);
+
+// Returns the owner of the page containing ptr
+DMALLOC_HOT PageOwner page_map_get(void *ptr);
+
+#endif
@@ -1,77 +1,391 @@
 #include "page_store.h"
+#include "address_space.h"
+#include "decay.h"
 #include "mmap_allocator.h"
+#include "stats.h"
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
-// The number of papes to keep cached
-#ifndef STORE_SIZE
-#define STORE_SIZE 4
+// How many times the configured number of spans the store can grow to keep
+// for a span size that is being mapped and unmapped over and over
+#ifndef STORE_GROWTH_LIMIT
+#define STORE_GROWTH_LIMIT 16
 #endif
 
-// The store that holds the pages
+// Every span size has a lock free stack (LIFO) shared by all threads. The
+// link to the next span is kept in the cached span itself so the store needs
+// no memory of its own and hands out the most recently used spans first
 
-static MmapAllocation store[STORE_SIZE] = {0};
+// Pointers only use the lower 48 bits of an address so the upper bits of the
+// top of the stack hold a tag that changes on every update. This prevents a
+// thread from swapping in a stale next page if the top was popped and pushed
+// again in the meantime (the ABA problem)
+#define TAG_SHIFT 48
+#define POINTER_MASK (((uintptr_t)1 << TAG_SHIFT) - 1)
 
-// Determines if the MmapAllocation is 0 initialized 
-static inline bool is_zero_initalized(MmapAllocation allocation) {
-  return allocation.ptr == NULL && allocation.size == 0;
+// A span in the store
+typedef struct StoredPage {
+  // The span below this one in the stack
+  struct StoredPage *next;
+  // Whether the span has been used since it was mapped. Spans that were
+  // never used are still zero apart from this header
+  bool used;
+  // When the span was stored, on the clock of decay_clock
+  uint32_t stored_at;
+} StoredPage;
+
+// A stack of spans of one size
+typedef struct {
+  // The tagged pointer to the span on top of the stack
+  _Atomic uintptr_t top;
+  // The number of spans in the stack
+  atomic_size_t count;
+} SpanStack;
+
+// The spans kept for reuse for every span size
+static SpanStack stored[MAX_SPAN_SHIFT + 1] = {0};
+
+// The configured number of spans to keep for every span size. It is also the
+// number of extra spans mapped when the store is empty
+static atomic_size_t store_size = STORE_SIZE;
+
+// The number of spans currently kept for every span size. It grows while
+// spans are released only to be mapped again
+static atomic_size_t capacity[MAX_SPAN_SHIFT + 1] = {
+    [0 ... MAX_SPAN_SHIFT] = STORE_SIZE};
+
+// Whether a span was released because the store was full since spans were
+// last mapped for every span size
+static atomic_bool released[MAX_SPAN_SHIFT + 1] = {0};
+
+// The number of threads busy popping a span. A popping thread may still read
+// the link of a span that was taken by another thread so spans are only
+// unmapped while no thread is popping. Spans in the reserved range are never
+// unmapped so they can always be read
+static atomic_size_t num_popping = 0;
+
+// Extracts the page from a tagged pointer
+static inline StoredPage *untag(uintptr_t tagged) {
+  return (StoredPage *)(tagged & POINTER_MASK);
+}
+
+// Creates a tagged pointer with the tag following the one of previous
+static inline uintptr_t retag(StoredPage *page, uintptr_t previous) {
+  uintptr_t tag = (previous >> TAG_SHIFT) + 1;
+  return (uintptr_t)page | (tag << TAG_SHIFT);
+}
+
+// Calculates the span shift from the size of a span
+static inline size_t calculate_span_shift(size_t size) {
+  return __builtin_ctzll(size / get_page_size());
 }
 
-MmapAllocation retrieve_page() {
-  // find first free page
-  for (size_t i = 0; i < STORE_SIZE; i++) {
-    MmapAllocation allocation = store[i];
+// Pushes a chain of linked spans onto a stack
+static inline void push_pages(SpanStack *stack, StoredPage *first,
+                              StoredPage *last, size_t count) {
+  // counted before the spans can be popped so the count never drops below 0
+  atomic_fetch_add_explicit(&stack->count, count, memory_order_relaxed);
+
+  uintptr_t old_top = atomic_load_explicit(&stack->top, memory_order_relaxed);
+  do {
+    last->next = untag(old_top);
+  } while (!atomic_compare_exchange_weak_explicit(
+      &stack->top, &old_top, retag(first, old_top), memory_order_release,
+      memory_order_relaxed));
+}
 
-    // if a page is found
-    if (!is_zero_initalized(allocation)) {
-      // Mark spot as not available
-      store[i] = (MmapAllocation){0};
+// Pops a span off a stack or returns NULL if it is empty
+static inline StoredPage *pop_page(SpanStack *stack) {
+  atomic_fetch_add(&num_popping, 1);
 
-      // return allocation
-      return allocation;
+  uintptr_t old_top = atomic_load(&stack->top);
+  StoredPage *page;
+  while ((page = untag(old_top)) != NULL) {
+    // the span could have been taken by another thread in which case the
+    // link is garbage but the tag will have changed and the exchange fails
+    StoredPage *next = __atomic_load_n(&page->next, __ATOMIC_RELAXED);
+    if (atomic_compare_exchange_weak(&stack->top, &old_top,
+                                     retag(next, old_top))) {
+      atomic_fetch_sub_explicit(&stack->count, 1, memory_order_relaxed);
+      break;
     }
   }
 
-  // if no free spot is found then new pages need to be allocated
-  // allocate pages plus an extra one for memory that has to be allocated now
-  size_t pages_to_allocated = STORE_SIZE + 1;
-  MmapAllocation allocations = mmap_alloc(pages_to_allocated);
-  // the pointer to the beginning of the memory region
-  char *ptr = allocations.ptr;
+  atomic_fetch_sub(&num_popping, 1);
+  return page;
+}
+
+// Maps memory for spans, from the reserved address range if possible.
+// Returns NULL if out of memory
+static inline char *map_spans(size_t num_pages, size_t alignment) {
+  MmapAllocation allocation = address_space_alloc(num_pages, alignment);
+  if (__builtin_expect(allocation.ptr != NULL, 1)) {
+    return allocation.ptr;
+  }
+
+  allocation = mmap_alloc_aligned(num_pages, alignment);
+  if (__builtin_expect(allocation.ptr == MAP_FAILED, 0)) {
+    return NULL;
+  }
 
-  // getting the size of a page
-  size_t page_size = get_page_size();
+#if defined(PAGE_STORE_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+  // the reserved range is advised as a whole, memory outside of it is advised
+  // here. The advice is only a hint so the spans work the same if it is
+  // ignored
+  madvise(allocation.ptr, allocation.size, MADV_HUGEPAGE);
+  STAT_ADD(madvise_calls, 1);
+#endif
 
-  // all pages are allocated at once for effiency so the headers now need to be added
-  for (size_t i = 1; i < pages_to_allocated; i++) {    
-    store[i - 1] = (MmapAllocation) {
-      .ptr = (void *)(ptr + page_size * i),
-      .size = page_size,
+  return allocation.ptr;
+}
+
+MmapAllocation retrieve_span(size_t shift, bool *zeroed) {
+  // getting the size of a span
+  size_t span_size = get_page_size() << shift;
+
+  // take the most recently stored span
+  StoredPage *page = pop_page(&stored[shift]);
+  if (page != NULL) {
+    STAT_ADD(page_store_hits, 1);
+    if (zeroed != NULL) {
+      *zeroed = !page->used;
+    }
+    return (MmapAllocation){
+        .ptr = page,
+        .size = span_size,
     };
   }
 
+  // if no free spot is found then new spans need to be allocated
+  STAT_ADD(page_store_misses, 1);
+
+  // spans that were released had to be mapped again so the store keeps more
+  // of them from now on
+  if (atomic_exchange_explicit(&released[shift], false, memory_order_relaxed)) {
+    size_t limit = atomic_load_explicit(&store_size, memory_order_relaxed) *
+                   STORE_GROWTH_LIMIT;
+    size_t current = atomic_load_explicit(&capacity[shift], memory_order_relaxed);
+    size_t grown = current * 2 > limit ? limit : current * 2;
+    atomic_store_explicit(&capacity[shift], grown, memory_order_relaxed);
+  }
+
+  // the addresses of purged spans are reused before more of the reserved
+  // range is used, their memory reads as zero
+  MmapAllocation reused = address_space_reuse((size_t)1 << shift);
+  if (reused.ptr != NULL) {
+    if (zeroed != NULL) {
+      *zeroed = true;
+    }
+    return reused;
+  }
+
+#ifdef PAGE_STORE_HUGE_PAGES
+  // a whole huge page is carved up into spans
+  size_t spans_to_allocate = HUGE_PAGE_SIZE / span_size;
+  char *ptr = map_spans(HUGE_PAGE_SIZE / get_page_size(), HUGE_PAGE_SIZE);
+#else
+  // allocate spans plus an extra one for memory that has to be allocated now
+  size_t spans_to_allocate =
+      atomic_load_explicit(&store_size, memory_order_relaxed) + 1;
+  char *ptr = map_spans(spans_to_allocate << shift, span_size);
+#endif
+  if (__builtin_expect(ptr == NULL, 0)) {
+    return (MmapAllocation){0};
+  }
+
+  // fresh memory from the os is always zero
+  if (zeroed != NULL) {
+    *zeroed = true;
+  }
+
+  // all spans are allocated at once for effiency so they now need to be
+  // linked together before they are stored
+  if (spans_to_allocate > 1) {
+    uint32_t now = decay_clock();
+    StoredPage *first = (StoredPage *)(ptr + span_size);
+    StoredPage *last = (StoredPage *)(ptr + span_size * (spans_to_allocate - 1));
+    for (size_t i = 1; i < spans_to_allocate; i++) {
+      StoredPage *span = (StoredPage *)(ptr + span_size * i);
+      span->next = (StoredPage *)(ptr + span_size * (i + 1));
+      span->stored_at = now;
+    }
+    push_pages(&stored[shift], first, last, spans_to_allocate - 1);
+  }
+
   MmapAllocation allocation = {
    .ptr = ptr,
-   .size = page_size, 
+   .size = span_size,
   };
 
-  return allocation; 
+  return allocation;
 }
 
-void store_page(MmapAllocation allocation) {
-  // finding free slot to store page
-  for (size_t i = 0; i < STORE_SIZE; i++) {
-    MmapAllocation allocation = store[i];
+void store_span(MmapAllocation allocation) {
+  size_t shift = calculate_span_shift(allocation.size);
+  StoredPage *page = allocation.ptr;
+
+#ifndef PAGE_STORE_HUGE_PAGES
+  // if the store is full the memory is given back to the os
+  if (atomic_load_explicit(&stored[shift].count, memory_order_relaxed) >=
+      atomic_load_explicit(&capacity[shift], memory_order_relaxed)) {
+    // spans in the reserved range keep their addresses for later
+    if (address_space_contains(page)) {
+      atomic_store_explicit(&released[shift], true, memory_order_relaxed);
+      address_space_purge(allocation);
+      return;
+    }
 
-    // if a page is found
-    if (is_zero_initalized(allocation)) {
-      // Mark spot as not available
-      store[i] = allocation;
+    // other spans are unmapped, unless another thread could still be looking
+    // at the span
+    if (atomic_load(&num_popping) == 0) {
+      atomic_store_explicit(&released[shift], true, memory_order_relaxed);
+      mmap_free(allocation);
       return;
     }
   }
+#endif
 
-  // if no free spot is found deallocate memory
-  mmap_free(allocation);
+  page->used = true;
+  page->stored_at = decay_clock();
+  push_pages(&stored[shift], page, page, 1);
 }
+
+// Releases the spans of one size that were stored before cutoff. Returns the
+// number of bytes released
+static size_t decay_spans(size_t shift, uint32_t now, uint32_t idle) {
+  SpanStack *stack = &stored[shift];
+  if (untag(atomic_load_explicit(&stack->top, memory_order_relaxed)) == NULL) {
+    return 0;
+  }
+
+  // the whole stack is taken so that spans can be removed from the middle
+  uintptr_t old_top = atomic_load(&stack->top);
+  while (!atomic_compare_exchange_weak(&stack->top, &old_top,
+                                       retag(NULL, old_top))) {
+  }
+
+  size_t span_size = get_page_size() << shift;
+  size_t released_bytes = 0;
+  size_t num_taken = 0;
+  size_t num_kept = 0;
+  StoredPage *kept_first = NULL;
+  StoredPage *kept_last = NULL;
+  StoredPage *unmap_first = NULL;
+
+  StoredPage *page = untag(old_top);
+  while (page != NULL) {
+    StoredPage *next = page->next;
+    num_taken++;
+
+    MmapAllocation allocation = {.ptr = page, .size = span_size};
+    if ((uint32_t)(now - page->stored_at) < idle) {
+      // recently used spans are kept
+      page->next = NULL;
+      if (kept_last == NULL) {
+        kept_first = page;
+      } else {
+        kept_last->next = page;
+      }
+      kept_last = page;
+      num_kept++;
+    } else if (address_space_contains(page)) {
+      address_space_purge(allocation);
+      released_bytes += span_size;
+    } else {
+      page->next = unmap_first;
+      unmap_first = page;
+    }
+
+    page = next;
+  }
+
+  // another thread may have been popping from the stack before it was taken
+  // and still be reading a span, in which case the spans are kept until the
+  // next time
+  if (atomic_load(&num_popping) == 0) {
+    while (unmap_first != NULL) {
+      StoredPage *next = unmap_first->next;
+      mmap_free((MmapAllocation){.ptr = unmap_first, .size = span_size});
+      released_bytes += span_size;
+      unmap_first = next;
+    }
+  }
+  while (unmap_first != NULL) {
+    StoredPage *next = unmap_first->next;
+    unmap_first->next = NULL;
+    if (kept_last == NULL) {
+      kept_first = unmap_first;
+    } else {
+      kept_last->next = unmap_first;
+    }
+    kept_last = unmap_first;
+    num_kept++;
+    unmap_first = next;
+  }
+
+  // the taken spans are counted again when the kept ones are pushed back
+  atomic_fetch_sub_explicit(&stack->count, num_taken, memory_order_relaxed);
+  if (kept_first != NULL) {
+    push_pages(stack, kept_first, kept_last, num_kept);
+  }
+
+  return released_bytes;
+}
+
+size_t decay_page_store(uint32_t now, uint32_t idle) {
+#ifdef PAGE_STORE_HUGE_PAGES
+  // giving back a single span would split the huge page it was carved from
+  // so the store keeps every span it carved
+  (void)now;
+  (void)idle;
+  return 0;
+#endif
+
+  size_t released_bytes = 0;
+  for (size_t shift = 0; shift <= MAX_SPAN_SHIFT; shift++) {
+    size_t bytes = decay_spans(shift, now, idle);
+    released_bytes += bytes;
+
+    // the store grew to keep spans that are not needed anymore so it shrinks
+    // back towards the configured size
+    if (bytes != 0) {
+      size_t size = atomic_load_explicit(&store_size, memory_order_relaxed);
+      size_t current =
+          atomic_load_explicit(&capacity[shift], memory_order_relaxed);
+      size_t shrunk = current / 2 < size ? size : current / 2;
+      atomic_store_explicit(&capacity[shift], shrunk, memory_order_relaxed);
+    }
+  }
+
+  return released_bytes;
+}
+
+MmapAllocation retrieve_page(bool *zeroed) { return retrieve_span(0, zeroed); }
+
+void set_store_size(size_t size) {
+  atomic_store_explicit(&store_size, size, memory_order_relaxed);
+  for (size_t shift = 0; shift <= MAX_SPAN_SHIFT; shift++) {
+    atomic_store_explicit(&capacity[shift], size, memory_order_relaxed);
+  }
+}
+
+// The number of spans to keep can be set with DMALLOC_STORE_SIZE
+__attribute__((constructor)) static void init_store_size() {
+  const char *value = getenv("DMALLOC_STORE_SIZE");
+  if (value == NULL || value[0] == '\0') {
+    return;
+  }
+
+  char *end;
+  unsigned long long size = strtoull(value, &end, 10);
+  if (*end == '\0') {
+    set_store_size(size);
+  }
+}
+
+void store_page(MmapAllocation allocation) { store_span(allocation); }
@@ -1,15 +1,58 @@
-// This is used for keeping a cache of memory pages so that that can quickly be retrieved
+// This is used for keeping a cache of memory pages so that that can quickly be retrieved.
+// The cache is lock free and shared by all threads
 
 #ifndef PAGE_STORE_H
 #define PAGE_STORE_H
 
 #include "mmap_allocator.h"
+#include <stdbool.h>
+#include <stdint.h>
 
-// Retrieves a stored page
-MmapAllocation retrieve_page();
+// The largest span that can be stored is 2^MAX_SPAN_SHIFT pages
+#ifndef MAX_SPAN_SHIFT
+#define MAX_SPAN_SHIFT 4
+#endif
+
+// The number of papes to keep cached for every span size by default. It can
+// be changed with the DMALLOC_STORE_SIZE environment variable or
+// dmalloc_set_store_size
+#ifndef STORE_SIZE
+#define STORE_SIZE 4
+#endif
+
+// When PAGE_STORE_HUGE_PAGES is defined spans are carved out of regions of
+// HUGE_PAGE_SIZE bytes that the os is asked to back with transparent huge
+// pages, so that many small objects need few TLB entries. Spans can then not
+// be unmapped on their own without splitting the huge page so the store
+// keeps every span it carved
+// #define PAGE_STORE_HUGE_PAGES
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+// Retrieves the most recently stored page. If zeroed is not NULL it is set to
+// whether the memory of the page after its first 16 bytes is known to be zero
+MmapAllocation retrieve_page(bool *zeroed);
 
 // Stores a page so that it can be retrieved later.
 // If the store is full the page is deallocated instead
 void store_page(MmapAllocation allocation);
 
+// Retrieves a stored span of 2^shift contiguous pages. The span is aligned to
+// its size. If zeroed is not NULL it is set to whether the memory of the span
+// after its first 16 bytes is known to be zero
+MmapAllocation retrieve_span(size_t shift, bool *zeroed);
+
+// Stores a span retrieved with retrieve_span so that it can be retrieved
+// later. If the store is full the span is deallocated instead. The store
+// keeps more spans of a size whose spans are unmapped and then mapped again
+void store_span(MmapAllocation allocation);
+
+// Gives back the memory of the spans that have been in the store for idle or
+// more milliseconds at time now, and shrinks the store back towards its
+// configured size. Returns the number of bytes given back
+size_t decay_page_store(uint32_t now, uint32_t idle);
+
+// Sets the number of spans the store keeps for every span size before it
+// adapts to how often spans are mapped. Spans already in the store are kept
+void set_store_size(size_t size);
+
 #endif
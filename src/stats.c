@@ -0,0 +1,221 @@
+#include "stats.h"
+#include "mmap_allocator.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+_Thread_local ThreadStats *thread_stats = NULL;
+
+// Every set of counters that was ever created. Counters of exited threads
+// are kept so that their counts are not lost
+static ThreadStats *all_stats = NULL;
+
+// Counters of exited threads that can be reused by new threads
+static ThreadStats *unused_stats = NULL;
+
+// Used when no memory could be mapped for the counters of a thread. Every
+// thread without counters of its own adds to these without atomic
+// read-modify-write so their counts are approximate
+static ThreadStats fallback_stats;
+
+// Protects all_stats and unused_stats
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Used to release the counters of a thread when it exits
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+// Hands the counters of an exiting thread over to the next thread created
+static void release_thread_stats(void *arg) {
+  ThreadStats *stats = arg;
+
+  pthread_mutex_lock(&stats_lock);
+  stats->next_unused = unused_stats;
+  unused_stats = stats;
+  pthread_mutex_unlock(&stats_lock);
+
+  thread_stats = NULL;
+}
+
+static void create_stats_key() {
+  pthread_key_create(&stats_key, release_thread_stats);
+}
+
+ThreadStats *register_thread_stats() {
+  pthread_once(&stats_key_once, create_stats_key);
+
+  pthread_mutex_lock(&stats_lock);
+  if (unused_stats == NULL) {
+    // The memory is mapped directly since going through the allocator would
+    // count into the counters that are being created
+    size_t size = calculate_num_pages(sizeof(ThreadStats)) * PAGE_SIZE;
+    ThreadStats *block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (__builtin_expect(block == MAP_FAILED, 0)) {
+      pthread_mutex_unlock(&stats_lock);
+      thread_stats = &fallback_stats;
+      return thread_stats;
+    }
+
+    for (size_t i = 0; i < size / sizeof(ThreadStats); i++) {
+      block[i].next = all_stats;
+      all_stats = &block[i];
+      block[i].next_unused = unused_stats;
+      unused_stats = &block[i];
+    }
+  }
+
+  ThreadStats *stats = unused_stats;
+  unused_stats = stats->next_unused;
+  pthread_mutex_unlock(&stats_lock);
+
+  // The counters are set first since registering them can allocate memory
+  thread_stats = stats;
+  pthread_setspecific(stats_key, stats);
+
+  return stats;
+}
+
+// Reads a counter of any thread
+static inline size_t read_counter(size_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Calculates how many of the allocations are still live. The counters of
+// different threads are not read at the same time so there can appear to be
+// more frees than allocations
+static inline size_t live(size_t allocated, size_t freed) {
+  return allocated > freed ? allocated - freed : 0;
+}
+
+// Adds the counters of a thread to the totals
+static void add_counters(ThreadStats *total, ThreadStats *stats) {
+  size_t *totals = (size_t *)total;
+  size_t *counters = (size_t *)stats;
+
+  // every field before the links is a counter
+  for (size_t i = 0; i < offsetof(ThreadStats, next) / sizeof(size_t); i++) {
+    totals[i] += read_counter(&counters[i]);
+  }
+}
+
+// Adds up the counters of all threads
+static void sum_thread_stats(ThreadStats *total) {
+  *total = (ThreadStats){0};
+
+  pthread_mutex_lock(&stats_lock);
+  for (ThreadStats *stats = all_stats; stats; stats = stats->next) {
+    add_counters(total, stats);
+  }
+  pthread_mutex_unlock(&stats_lock);
+
+  add_counters(total, &fallback_stats);
+}
+
+void dmalloc_stats(DmallocStats *stats) {
+  ThreadStats total;
+  sum_thread_stats(&total);
+
+  *stats = (DmallocStats){0};
+
+  for (size_t i = 0; i < NUM_BINS; i++) {
+    DmallocClassStats *class = &stats->classes[i];
+    class->size = BIN_CLASS_SIZE(i);
+    class->allocs = total.bin_allocs[i];
+    class->frees = total.bin_frees[i];
+    class->live_bytes = live(class->allocs, class->frees) * class->size;
+
+    stats->bins.allocs += class->allocs;
+    stats->bins.frees += class->frees;
+    stats->bins.live_bytes += class->live_bytes;
+  }
+  stats->bins.live_regions = live(total.bins_created, total.bins_released);
+
+  stats->free_list = (DmallocAllocatorStats){
+      .allocs = total.free_list_allocs,
+      .frees = total.free_list_frees,
+      .live_bytes =
+          live(total.free_list_alloc_bytes, total.free_list_free_bytes),
+      .live_regions = live(total.chunks_created, total.chunks_released),
+  };
+
+  stats->huge = (DmallocAllocatorStats){
+      .allocs = total.huge_allocs,
+      .frees = total.huge_frees,
+      .live_bytes = live(total.huge_alloc_bytes, total.huge_free_bytes),
+      .live_regions = live(total.huge_allocs, total.huge_frees),
+  };
+
+  stats->page_store_hits = total.page_store_hits;
+  stats->page_store_misses = total.page_store_misses;
+  stats->huge_cache_hits = total.huge_cache_hits;
+  stats->huge_cache_misses = total.huge_cache_misses;
+  stats->mmap_calls = total.mmap_calls;
+  stats->munmap_calls = total.munmap_calls;
+  stats->mremap_calls = total.mremap_calls;
+  stats->mprotect_calls = total.mprotect_calls;
+  stats->madvise_calls = total.madvise_calls;
+  stats->live_bytes =
+      stats->bins.live_bytes + stats->free_list.live_bytes +
+      stats->huge.live_bytes;
+  stats->mapped_bytes = live(total.mapped_bytes, total.unmapped_bytes);
+}
+
+// Prints the statistics of one allocator
+static void print_allocator_stats(FILE *stream, const char *name,
+                                  const char *regions,
+                                  DmallocAllocatorStats *stats) {
+  fprintf(stream, "%-10s allocs %12zu  frees %12zu  live %12zu bytes  %s %zu\n",
+          name, stats->allocs, stats->frees, stats->live_bytes, regions,
+          stats->live_regions);
+}
+
+void dmalloc_print_stats(FILE *stream) {
+  DmallocStats stats;
+  dmalloc_stats(&stats);
+
+  fprintf(stream, "dmalloc statistics\n");
+  print_allocator_stats(stream, "bins", "bins", &stats.bins);
+  print_allocator_stats(stream, "free list", "chunks", &stats.free_list);
+  print_allocator_stats(stream, "huge", "mappings", &stats.huge);
+
+  fprintf(stream, "live %zu bytes  mapped %zu bytes", stats.live_bytes,
+          stats.mapped_bytes);
+  if (stats.mapped_bytes != 0) {
+    fprintf(stream, "  utilization %.1f%%",
+            100.0 * stats.live_bytes / stats.mapped_bytes);
+  }
+  fprintf(stream, "\n");
+
+  fprintf(stream, "page store hits %zu misses %zu  huge cache hits %zu misses %zu\n",
+          stats.page_store_hits, stats.page_store_misses,
+          stats.huge_cache_hits, stats.huge_cache_misses);
+  fprintf(stream, "mmap %zu  munmap %zu  mremap %zu  mprotect %zu  madvise %zu\n",
+          stats.mmap_calls, stats.munmap_calls, stats.mremap_calls,
+          stats.mprotect_calls, stats.madvise_calls);
+
+  fprintf(stream, "%8s %12s %12s %12s\n", "class", "allocs", "frees",
+          "live bytes");
+  for (size_t i = 0; i < NUM_BINS; i++) {
+    DmallocClassStats *class = &stats.classes[i];
+    if (class->allocs != 0) {
+      fprintf(stream, "%8zu %12zu %12zu %12zu\n", class->size, class->allocs,
+              class->frees, class->live_bytes);
+    }
+  }
+}
+
+void stats_lock_all() { pthread_mutex_lock(&stats_lock); }
+
+void stats_unlock_all() { pthread_mutex_unlock(&stats_lock); }
+
+static void print_stats_on_exit() { dmalloc_print_stats(stderr); }
+
+// The statistics are printed on exit if DMALLOC_STATS is set to anything
+// other than 0
+__attribute__((constructor)) static void init_stats() {
+  const char *value = getenv("DMALLOC_STATS");
+  if (value != NULL && value[0] != '\0' && value[0] != '0') {
+    atexit(print_stats_on_exit);
+  }
+}
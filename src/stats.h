@@ -0,0 +1,122 @@
+// This keeps statistics about what the allocator is doing. Every thread
+// counts into its own counters which are only added up when the statistics
+// are requested so counting is cheap enough to always be enabled
+#ifndef STATS_H
+#define STATS_H
+
+#include "bin.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// The statistics of a bin size class
+typedef struct {
+  // the size of the blocks of the class
+  size_t size;
+  // the number of blocks allocated and freed
+  size_t allocs;
+  size_t frees;
+  // the number of bytes in blocks that are allocated
+  size_t live_bytes;
+} DmallocClassStats;
+
+// The statistics of one of the allocators
+typedef struct {
+  // the number of allocations and frees
+  size_t allocs;
+  size_t frees;
+  // the number of bytes that are allocated, including rounding up
+  size_t live_bytes;
+  // the number of bins, chunks or mappings that are in use
+  size_t live_regions;
+} DmallocAllocatorStats;
+
+// The statistics of the whole allocator
+typedef struct {
+  DmallocClassStats classes[NUM_BINS];
+  DmallocAllocatorStats bins;
+  DmallocAllocatorStats free_list;
+  DmallocAllocatorStats huge;
+  // spans taken from the page store and spans that had to be mapped
+  size_t page_store_hits;
+  size_t page_store_misses;
+  // huge allocations that reused a cached mapping and that could have but
+  // had to map a new one
+  size_t huge_cache_hits;
+  size_t huge_cache_misses;
+  // the number of calls made to the os
+  size_t mmap_calls;
+  size_t munmap_calls;
+  size_t mremap_calls;
+  size_t mprotect_calls;
+  size_t madvise_calls;
+  // the number of bytes that are allocated by all allocators
+  size_t live_bytes;
+  // the number of bytes mapped from the os, anything not live is overhead or
+  // held in caches
+  size_t mapped_bytes;
+} DmallocStats;
+
+// Collects the statistics of all threads
+void dmalloc_stats(DmallocStats *stats);
+
+// Prints the statistics of all threads in a human readable form. They are
+// printed to stderr on exit if the DMALLOC_STATS environment variable is set
+void dmalloc_print_stats(FILE *stream);
+
+// The counters of a thread
+typedef struct ThreadStats {
+  size_t bin_allocs[NUM_BINS];
+  size_t bin_frees[NUM_BINS];
+  size_t bins_created;
+  size_t bins_released;
+  size_t free_list_allocs;
+  size_t free_list_frees;
+  size_t free_list_alloc_bytes;
+  size_t free_list_free_bytes;
+  size_t chunks_created;
+  size_t chunks_released;
+  size_t huge_allocs;
+  size_t huge_frees;
+  size_t huge_alloc_bytes;
+  size_t huge_free_bytes;
+  size_t huge_cache_hits;
+  size_t huge_cache_misses;
+  size_t page_store_hits;
+  size_t page_store_misses;
+  size_t mmap_calls;
+  size_t munmap_calls;
+  size_t mremap_calls;
+  size_t mprotect_calls;
+  size_t madvise_calls;
+  size_t mapped_bytes;
+  size_t unmapped_bytes;
+  // every set of counters ever created, they are never released
+  struct ThreadStats *next;
+  // the next set of counters that can be reused by a new thread
+  struct ThreadStats *next_unused;
+} ThreadStats;
+
+// The counters of the current thread
+extern _Thread_local ThreadStats *thread_stats;
+
+// Creates the counters of the current thread
+DMALLOC_NOINLINE ThreadStats *register_thread_stats();
+
+// Takes and releases the lock of the counters so that a fork can not happen
+// while another thread holds it
+void stats_lock_all();
+void stats_unlock_all();
+
+// Adds to a counter of the current thread. Only the thread itself writes its
+// counters so no atomic read-modify-write is needed
+#define STAT_ADD(counter, n)                                                   \
+  do {                                                                         \
+    ThreadStats *stats_ = thread_stats;                                        \
+    if (__builtin_expect(stats_ == NULL, 0)) {                                 \
+      stats_ = register_thread_stats();                                        \
+    }                                                                          \
+    __atomic_store_n(&stats_->counter, stats_->counter + (n),                  \
+                     __ATOMIC_RELAXED);                                        \
+  } while (0)
+
+#endif
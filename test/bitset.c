@@ -64,4 +64,45 @@ void bitset_test() {
   print_bitset(bitset); // Should print the bitset in human-readable format
 
   free(bitset);
+
+  // Test 10: A bitset with more words than bits in a summary word
+  const size_t many_bits = 64 * 130 + 7;
+  BitSet *large = malloc(size_of_bitset(many_bits));
+  init_bitset(large, many_bits);
+
+  // Free bits are found lowest first across words
+  for (size_t i = 0; i < many_bits; i++) {
+    assert(find_first_unmarked_bit(large) == (ssize_t)i);
+    mark_bit(large, i);
+  }
+  assert(find_first_unmarked_bit(large) == -1);
+  assert(all_bits_marked(large));
+
+  // Freeing bits in full words makes them findable again
+  unmark_bit(large, 8000);
+  unmark_bit(large, 100);
+  assert(find_first_unmarked_bit(large) == 100);
+  mark_bit(large, 100);
+  assert(find_first_unmarked_bit(large) == 8000);
+  flip_bit(large, 8000);
+  assert(find_first_unmarked_bit(large) == -1);
+
+  // Claiming bits in bulk moves across words
+  unmark_bits(large, 3, ~(WORD)0);
+  unmark_bits(large, 129, (WORD)1 << 5);
+  size_t indices[70];
+  assert(mark_unmarked_bits(large, 70, indices) == 65);
+  assert(indices[0] == 3 * 64 && indices[63] == 4 * 64 - 1);
+  assert(indices[64] == 129 * 64 + 5);
+
+  // The unused bits of the last word are never handed out
+  clear_bitset(large);
+  assert(all_bits_unmarked(large));
+  for (size_t i = 0; i < many_bits; i++) {
+    mark_bit(large, i);
+  }
+  assert(find_first_unmarked_bit(large) == -1);
+
+  free(large);
+  printf("PASS: Bitset test\n");
 }
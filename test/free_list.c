@@ -0,0 +1,90 @@
+#include "test.h"
+#include "../src/allocator.h"
+#include "../src/free_list.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_ALLOCATIONS 2000
+
+// Fills memory with a pattern derived from its index
+static void fill(unsigned char *ptr, size_t size, size_t index) {
+  memset(ptr, (int)(index & 0xFF), size);
+}
+
+// Checks that memory still holds the pattern derived from its index
+static void verify(unsigned char *ptr, size_t size, size_t index) {
+  for (size_t i = 0; i < size; i++) {
+    assert(ptr[i] == (unsigned char)(index & 0xFF));
+  }
+}
+
+void free_list_test() {
+  printf("Testing free list allocator...\n");
+
+  void *ptrs[NUM_ALLOCATIONS] = {0};
+  size_t sizes[NUM_ALLOCATIONS] = {0};
+
+  srand(7);
+
+  // randomly allocate and free medium sized objects
+  for (size_t round = 0; round < 20 * NUM_ALLOCATIONS; round++) {
+    size_t i = rand() % NUM_ALLOCATIONS;
+
+    if (ptrs[i] == NULL) {
+      sizes[i] = 1 + rand() % 2000;
+      ptrs[i] = free_list_alloc(sizes[i]);
+      assert(ptrs[i] != NULL);
+      assert((uintptr_t)ptrs[i] % MIN_ALIGNMENT == 0);
+      assert(free_list_size(ptrs[i]) >= sizes[i]);
+      fill(ptrs[i], sizes[i], i);
+    } else {
+      verify(ptrs[i], sizes[i], i);
+      dfree(ptrs[i]);
+      ptrs[i] = NULL;
+    }
+  }
+
+  for (size_t i = 0; i < NUM_ALLOCATIONS; i++) {
+    if (ptrs[i] != NULL) {
+      verify(ptrs[i], sizes[i], i);
+      dfree(ptrs[i]);
+    }
+  }
+
+  // neighbouring free blocks are coalesced so their memory can be reused for
+  // a larger allocation
+  void *a = free_list_alloc(1000);
+  void *b = free_list_alloc(1000);
+  void *c = free_list_alloc(1000);
+  assert(a != NULL && b != NULL && c != NULL);
+  dfree(b);
+  dfree(a);
+  void *d = free_list_alloc(2000);
+  assert(d == a);
+  dfree(c);
+  dfree(d);
+
+  // an allocation grows in place into the free block right after it
+  a = free_list_alloc(1100);
+  b = free_list_alloc(1100);
+  c = free_list_alloc(1100);
+  assert(a != NULL && b != NULL && c != NULL);
+  fill(a, 1100, 7);
+  dfree(b);
+  d = drealloc(a, 2000);
+  assert(d == a);
+  verify(d, 1100, 7);
+  // shrinking frees the end so the allocation can grow into it again
+  d = drealloc(d, 1100);
+  assert(d == a && free_list_size(d) < 2000);
+  d = drealloc(d, 2000);
+  assert(d == a);
+  verify(d, 1100, 7);
+  dfree(d);
+  dfree(c);
+
+  printf("PASS: Free list test\n");
+}
@@ -4,7 +4,7 @@
 #include "assert.h"
 #include "stdint.h"
 
-#define TESTING_TYPE int
+#define TESTING_TYPE long
 
 void small_allocator_basic_test() {
   printf("Size of type is %lu.\n", sizeof(TESTING_TYPE));
@@ -19,7 +19,7 @@ void small_allocator_basic_test() {
 
   *x = 42;
   *y = 7;
-  printf("The answer to the life, the universe and everything is %d.\n", *x);
+  printf("The answer to the life, the universe and everything is %ld.\n", *x);
 
   dfree(x);
   dfree(y);
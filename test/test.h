@@ -9,4 +9,10 @@ void bitset_test();
 // tests the bin allocator
 void small_allocator_basic_test();
 
+// tests the free list allocator
+void free_list_test();
+
+// tests allocating and freeing memory from multiple threads
+void threads_test();
+
 #endif
@@ -1,10 +1,16 @@
+#include "test.h"
 #include "../src/bin.h"
 #include "../src/allocator.h"
+#include "../src/address_space.h"
+#include "../src/arena.h"
+#include "../src/decay.h"
+#include "../src/stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <errno.h>
 
 // Test patterns to write to allocated memory
 #define PATTERN_A 0xAA
@@ -369,6 +375,771 @@ static bool test_mixed_size_stress() {
     return true;
 }
 
+// Test that allocations are rounded up to the closest size class
+static bool test_size_classes() {
+    printf("Testing size classes...\n");
+
+    size_t sizes[] = {1, 8, 9, 24, 40, 48, 65, 72, 100, 128, 200, 600, 1000};
+    size_t expected[] = {8, 8, 16, 32, 48, 48, 80, 80, 112, 128, 224, 640, 1024};
+    size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    for (size_t i = 0; i < num_sizes; i++) {
+        void *ptr = bin_alloc(sizes[i]);
+        struct Bin *bin = allocated_by_bin(ptr);
+        if (!bin || bin_size(bin) != expected[i]) {
+            printf("FAIL: Allocation of %zu bytes was not given %zu bytes\n",
+                   sizes[i], expected[i]);
+            return false;
+        }
+        bin_free(ptr, bin);
+    }
+
+    printf("PASS: Size classes test\n");
+    return true;
+}
+
+// Every allocation larger than 8 bytes must be able to hold any type
+static bool test_min_alignment() {
+    printf("Testing minimum alignment...\n");
+
+    // every allocator is used by some of the sizes
+    const size_t sizes[] = {9, 24, 40, 56, 100, 1000, 1100, 1500, 3000, 5000,
+                            100000, 1 << 20};
+    const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    void *ptrs[64];
+
+    for (size_t i = 0; i < num_sizes; i++) {
+        bool aligned = true;
+        for (size_t j = 0; j < 64; j++) {
+            ptrs[j] = j % 2 ? dcalloc(1, sizes[i]) : dmalloc(sizes[i]);
+            aligned &= (uintptr_t)ptrs[j] % MIN_ALIGNMENT == 0;
+        }
+        for (size_t j = 0; j < 64; j++) {
+            dfree(ptrs[j]);
+        }
+        if (!aligned) {
+            printf("FAIL: %zu byte allocation not aligned to %d\n", sizes[i],
+                   MIN_ALIGNMENT);
+            return false;
+        }
+    }
+
+    printf("PASS: Minimum alignment test\n");
+    return true;
+}
+
+// Test bins that span multiple pages
+static bool test_multi_page_bins() {
+    printf("Testing bins spanning multiple pages...\n");
+
+    const size_t alloc_size = 128;
+    const size_t num_allocs = 1000;
+    void *ptrs[1000];
+
+    for (size_t i = 0; i < num_allocs; i++) {
+        ptrs[i] = dmalloc(alloc_size);
+        if (!ptrs[i]) {
+            printf("FAIL: dmalloc(%zu) returned NULL\n", alloc_size);
+            return false;
+        }
+        fill_memory(ptrs[i], alloc_size, (uint8_t)i);
+    }
+
+    // The allocations in the middle of a span must belong to the same bin as
+    // the ones on the first page of the span
+    struct Bin *first_bin = allocated_by_bin(ptrs[0]);
+    size_t same_bin = 0;
+    for (size_t i = 0; i < num_allocs; i++) {
+        if (allocated_by_bin(ptrs[i]) == first_bin) {
+            same_bin++;
+        }
+    }
+    if (same_bin * alloc_size <= 4096) {
+        printf("FAIL: Bin only holds %zu allocations\n", same_bin);
+        return false;
+    }
+
+    for (size_t i = 0; i < num_allocs; i++) {
+        if (!verify_memory(ptrs[i], alloc_size, (uint8_t)i)) {
+            printf("FAIL: Memory corruption in multi page bin\n");
+            return false;
+        }
+        dfree(ptrs[i]);
+    }
+
+    printf("PASS: Multi page bins test\n");
+    return true;
+}
+
+static bool test_allocation_owner() {
+    printf("Testing allocation owner lookup...\n");
+
+    void *small = dmalloc(64);
+    void *medium = dmalloc(1500);
+    void *huge = dmalloc(100000);
+    void *system = malloc(64);
+
+    bool passed = true;
+    if (allocated_by_bin(small) == NULL) {
+        printf("FAIL: Bin allocation not found in the page map\n");
+        passed = false;
+    }
+    if (allocated_by_bin(medium) != NULL) {
+        printf("FAIL: Free list allocation reported as a bin allocation\n");
+        passed = false;
+    }
+    if (allocated_by_bin(huge) != NULL ||
+        allocated_by_bin((char *)huge + 90000) != NULL) {
+        printf("FAIL: Huge allocation reported as a bin allocation\n");
+        passed = false;
+    }
+    if (allocated_by_bin(system) != NULL) {
+        printf("FAIL: Memory not allocated by dmalloc reported as a bin allocation\n");
+        passed = false;
+    }
+
+    dfree(small);
+    dfree(medium);
+    dfree(huge);
+    free(system);
+
+    if (passed) {
+        printf("PASS: Allocation owner test\n");
+    }
+    return passed;
+}
+
+static bool test_huge_cache() {
+    printf("Testing huge mapping reuse...\n");
+
+    const size_t sizes[] = {65536, 100000, 1 << 20, 16 << 20};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint8_t *first = dmalloc(sizes[i]);
+        if ((uintptr_t)first % MIN_ALIGNMENT != 0) {
+            printf("FAIL: Huge mapping of %zu bytes is not aligned to %d\n",
+                   sizes[i], MIN_ALIGNMENT);
+            return false;
+        }
+        fill_memory(first, sizes[i], (uint8_t)i);
+        dfree(first);
+
+        // a freed mapping of the same size must be handed out again
+        uint8_t *second = dmalloc(sizes[i]);
+        if (second != first) {
+            printf("FAIL: Huge mapping of %zu bytes was not reused\n", sizes[i]);
+            return false;
+        }
+
+        // the whole mapping must still be usable
+        fill_memory(second, sizes[i], (uint8_t)(i + 1));
+        if (!verify_memory(second, sizes[i], (uint8_t)(i + 1))) {
+            printf("FAIL: Reused huge mapping is corrupted\n");
+            return false;
+        }
+        dfree(second);
+    }
+
+    printf("PASS: Huge mapping reuse test\n");
+    return true;
+}
+
+// Sizes close to SIZE_MAX must fail instead of wrapping around to a small
+// mapping
+static bool test_huge_overflow() {
+    printf("Testing huge sizes that overflow...\n");
+
+    errno = 0;
+    if (dmalloc(SIZE_MAX) != NULL || errno != ENOMEM) {
+        printf("FAIL: malloc of SIZE_MAX did not fail with ENOMEM\n");
+        return false;
+    }
+
+    errno = 0;
+    if (daligned_alloc(64, SIZE_MAX - 10) != NULL || errno != ENOMEM) {
+        printf("FAIL: Aligned allocation near SIZE_MAX did not fail with ENOMEM\n");
+        return false;
+    }
+
+    // both a huge allocation and a small one must be left untouched
+    const size_t sizes[] = {100000, 100};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        void *ptr = dmalloc(sizes[i]);
+        fill_memory(ptr, sizes[i], PATTERN_A);
+        errno = 0;
+        if (drealloc(ptr, SIZE_MAX - 10) != NULL || errno != ENOMEM) {
+            printf("FAIL: realloc of %zu bytes to near SIZE_MAX did not fail with ENOMEM\n",
+                   sizes[i]);
+            return false;
+        }
+        if (!verify_memory(ptr, sizes[i], PATTERN_A)) {
+            printf("FAIL: Failed realloc changed the allocation\n");
+            return false;
+        }
+        dfree(ptr);
+    }
+
+    printf("PASS: Huge overflow test\n");
+    return true;
+}
+
+static bool test_realloc_in_place() {
+    printf("Testing in place realloc...\n");
+
+    // growing within the size class of a bin does not move the memory
+    uint8_t *small = dmalloc(100);
+    if (drealloc(small, 110) != small) {
+        printf("FAIL: Realloc within a bin class moved the memory\n");
+        return false;
+    }
+    dfree(small);
+
+    // huge allocations are grown by remapping their pages
+    size_t size = 100000;
+    uint8_t *huge = dmalloc(size);
+    fill_memory(huge, size, 0x5A);
+    for (size_t new_size = 2 * size; new_size <= (64 << 20); new_size *= 2) {
+        huge = drealloc(huge, new_size);
+        if (huge == NULL || !verify_memory(huge, size, 0x5A)) {
+            printf("FAIL: Huge realloc to %zu bytes lost data\n", new_size);
+            return false;
+        }
+        fill_memory(huge + size, new_size - size, 0x5A);
+        size = new_size;
+    }
+
+    // shrinking back to a smaller allocator keeps the start of the data
+    huge = drealloc(huge, 500);
+    if (huge == NULL || !verify_memory(huge, 500, 0x5A)) {
+        printf("FAIL: Shrinking a huge allocation lost data\n");
+        return false;
+    }
+    dfree(huge);
+
+    printf("PASS: In place realloc test\n");
+    return true;
+}
+
+// Checks that memory only holds zeroes
+static bool is_zeroed(uint8_t *ptr, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (ptr[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_calloc() {
+    printf("Testing calloc...\n");
+
+    errno = 0;
+    if (dcalloc(SIZE_MAX / 2, 4) != NULL || errno != ENOMEM) {
+        printf("FAIL: Overflowing calloc did not fail with ENOMEM\n");
+        return false;
+    }
+
+    // memory is dirtied and freed first so that calloc has to reuse some of
+    // it and take the rest from fresh pages
+    const size_t sizes[] = {8, 24, 100, 1000, 1500, 2000, 100000, 1 << 20};
+    const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    void *ptrs[64];
+
+    for (size_t i = 0; i < num_sizes; i++) {
+        for (size_t j = 0; j < 64; j++) {
+            ptrs[j] = dmalloc(sizes[i]);
+            fill_memory(ptrs[j], sizes[i], 0xFF);
+        }
+        for (size_t j = 0; j < 64; j += 2) {
+            dfree(ptrs[j]);
+        }
+
+        for (size_t j = 0; j < 64; j += 2) {
+            ptrs[j] = dcalloc(1, sizes[i]);
+        }
+        for (size_t j = 0; j < 64; j++) {
+            uint8_t *extra = dcalloc(sizes[i], 1);
+            bool zeroed = is_zeroed(extra, sizes[i]) &&
+                          (j % 2 == 1 || is_zeroed(ptrs[j], sizes[i]));
+            dfree(extra);
+            if (!zeroed) {
+                printf("FAIL: calloc of %zu bytes returned dirty memory\n", sizes[i]);
+                return false;
+            }
+        }
+
+        for (size_t j = 0; j < 64; j++) {
+            dfree(ptrs[j]);
+        }
+    }
+
+    printf("PASS: Calloc test\n");
+    return true;
+}
+
+static bool test_aligned_alloc() {
+    printf("Testing aligned allocation...\n");
+
+    void *ptr = NULL;
+    if (dposix_memalign(&ptr, 24, 64) != EINVAL || daligned_alloc(48, 64) != NULL) {
+        printf("FAIL: Invalid alignment was accepted\n");
+        return false;
+    }
+    errno = 0;
+    if (dmemalign(48, 64) != NULL || errno != EINVAL) {
+        printf("FAIL: Invalid alignment did not set errno to EINVAL\n");
+        return false;
+    }
+
+    // every allocator is used by some of the combinations
+    const size_t sizes[] = {1, 40, 200, 1000, 1500, 3000, 100000};
+    const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    void *ptrs[num_sizes][16];
+
+    for (size_t alignment = 16; alignment <= (2 << 20); alignment *= 2) {
+        for (size_t i = 0; i < num_sizes; i++) {
+            for (size_t j = 0; j < 16; j++) {
+                if (dposix_memalign(&ptrs[i][j], alignment, sizes[i]) != 0) {
+                    printf("FAIL: posix_memalign(%zu, %zu) failed\n", alignment, sizes[i]);
+                    return false;
+                }
+                if ((uintptr_t)ptrs[i][j] % alignment != 0) {
+                    printf("FAIL: %zu byte allocation not aligned to %zu\n", sizes[i], alignment);
+                    return false;
+                }
+                fill_memory(ptrs[i][j], sizes[i], (uint8_t)(i + j));
+            }
+        }
+
+        for (size_t i = 0; i < num_sizes; i++) {
+            for (size_t j = 0; j < 16; j++) {
+                if (!verify_memory(ptrs[i][j], sizes[i], (uint8_t)(i + j))) {
+                    printf("FAIL: Aligned allocation was corrupted\n");
+                    return false;
+                }
+                dfree(ptrs[i][j]);
+            }
+        }
+    }
+
+    printf("PASS: Aligned allocation test\n");
+    return true;
+}
+
+static bool test_sized_free() {
+    printf("Testing sized free and usable size...\n");
+
+    if (dmalloc_usable_size(NULL) != 0) {
+        printf("FAIL: Usable size of NULL is not 0\n");
+        return false;
+    }
+
+    const size_t sizes[] = {0, 1, 8, 100, 500, 1024, 1025, 2000, 5000, 1 << 20};
+    const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    void *ptrs[num_sizes][300];
+
+    for (size_t i = 0; i < num_sizes; i++) {
+        for (size_t j = 0; j < 300; j++) {
+            ptrs[i][j] = dmalloc(sizes[i]);
+
+            // all of the usable memory belongs to the allocation
+            size_t usable = dmalloc_usable_size(ptrs[i][j]);
+            if (usable < sizes[i]) {
+                printf("FAIL: Usable size %zu is less than %zu\n", usable, sizes[i]);
+                return false;
+            }
+            fill_memory(ptrs[i][j], usable, (uint8_t)j);
+        }
+    }
+
+    for (size_t i = 0; i < num_sizes; i++) {
+        for (size_t j = 0; j < 300; j++) {
+            if (!verify_memory(ptrs[i][j], dmalloc_usable_size(ptrs[i][j]), (uint8_t)j)) {
+                printf("FAIL: Memory corruption before sized free\n");
+                return false;
+            }
+            dfree_sized(ptrs[i][j], sizes[i]);
+        }
+    }
+
+    // the freed memory must be reusable
+    for (size_t i = 0; i < num_sizes; i++) {
+        void *ptr = dmalloc(sizes[i]);
+        fill_memory(ptr, sizes[i], 0xAA);
+        dfree_sized(ptr, sizes[i]);
+    }
+
+    printf("PASS: Sized free test\n");
+    return true;
+}
+
+static bool test_batch() {
+    printf("Testing batch allocation...\n");
+
+    const size_t sizes[] = {8, 48, 200, 1024, 2000};
+    const size_t n = 5000;
+    static void *ptrs[5000];
+
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            if (dmalloc_batch(sizes[i], n, ptrs) != n) {
+                printf("FAIL: Batch of %zu byte allocations failed\n", sizes[i]);
+                return false;
+            }
+
+            // the allocations must not overlap
+            for (size_t j = 0; j < n; j++) {
+                memset(ptrs[j], 0, sizes[i]);
+                *(size_t *)ptrs[j] = j;
+            }
+            for (size_t j = 0; j < n; j++) {
+                if (*(size_t *)ptrs[j] != j) {
+                    printf("FAIL: Batch allocations of %zu bytes overlap\n", sizes[i]);
+                    return false;
+                }
+            }
+
+            // freed in an order that mixes bins and has holes
+            for (size_t j = 0; j < n; j += 7) {
+                dfree(ptrs[j]);
+                ptrs[j] = NULL;
+            }
+            dfree_batch(ptrs + n / 2, n - n / 2);
+            dfree_batch(ptrs, n / 2);
+        }
+    }
+
+    printf("PASS: Batch allocation test\n");
+    return true;
+}
+
+static bool test_stats() {
+    printf("Testing allocator statistics...\n");
+
+    DmallocStats before;
+    dmalloc_stats(&before);
+
+    void *small[100];
+    for (size_t i = 0; i < 100; i++) {
+        small[i] = dmalloc(100);
+    }
+    void *medium = dmalloc(1500);
+    void *huge = dmalloc(1 << 20);
+
+    DmallocStats during;
+    dmalloc_stats(&during);
+
+    size_t index = 0;
+    while (during.classes[index].size < 100) {
+        index++;
+    }
+    bool passed = true;
+    if (during.classes[index].allocs - before.classes[index].allocs != 100 ||
+        during.classes[index].live_bytes - before.classes[index].live_bytes !=
+            100 * during.classes[index].size) {
+        printf("FAIL: Bin allocations were not counted\n");
+        passed = false;
+    }
+    if (during.free_list.allocs - before.free_list.allocs != 1 ||
+        during.huge.allocs - before.huge.allocs != 1 ||
+        during.huge.live_bytes - before.huge.live_bytes < (1 << 20)) {
+        printf("FAIL: Free list or huge allocations were not counted\n");
+        passed = false;
+    }
+    if (during.mapped_bytes < during.live_bytes) {
+        printf("FAIL: More memory is live than mapped\n");
+        passed = false;
+    }
+
+    for (size_t i = 0; i < 100; i++) {
+        dfree(small[i]);
+    }
+    dfree(medium);
+    dfree(huge);
+
+    DmallocStats after;
+    dmalloc_stats(&after);
+    if (after.live_bytes != before.live_bytes ||
+        after.bins.frees - before.bins.frees != 100) {
+        printf("FAIL: Frees were not counted\n");
+        passed = false;
+    }
+
+    if (passed) {
+        printf("PASS: Allocator statistics test\n");
+    }
+    return passed;
+}
+
+static bool test_partial_bins() {
+    printf("Testing reuse of partially free bins...\n");
+
+    // Fill several bins and free every other block so that every bin has
+    // free blocks left
+    void *ptrs[4000];
+    for (size_t i = 0; i < 4000; i++) {
+        ptrs[i] = dmalloc(64);
+    }
+    for (size_t i = 0; i < 4000; i += 2) {
+        dfree(ptrs[i]);
+    }
+
+    DmallocStats before;
+    dmalloc_stats(&before);
+
+    // The freed blocks are enough for the new allocations so no bin is added
+    for (size_t i = 0; i < 4000; i += 2) {
+        ptrs[i] = dmalloc(64);
+    }
+
+    DmallocStats after;
+    dmalloc_stats(&after);
+
+    for (size_t i = 0; i < 4000; i++) {
+        dfree(ptrs[i]);
+    }
+
+    if (after.bins.live_regions != before.bins.live_regions) {
+        printf("FAIL: %zu bins were created while others had free blocks\n",
+               after.bins.live_regions - before.bins.live_regions);
+        return false;
+    }
+
+    printf("PASS: Partially free bins test\n");
+    return true;
+}
+
+static bool test_empty_bin_retention() {
+    printf("Testing retention of an empty bin...\n");
+
+    // Allocate until a new bin is needed
+    void *ptrs[4096];
+    size_t count = 0;
+    DmallocStats stats;
+    dmalloc_stats(&stats);
+    size_t regions = stats.bins.live_regions;
+    while (count < 4096) {
+        ptrs[count++] = dmalloc(200);
+        dmalloc_stats(&stats);
+        if (stats.bins.live_regions != regions) {
+            break;
+        }
+    }
+
+    // Going back and forth over the boundary of the bin keeps the empty bin
+    // instead of retrieving a span every time
+    dfree(ptrs[--count]);
+    DmallocStats before;
+    dmalloc_stats(&before);
+    for (size_t i = 0; i < 100; i++) {
+        dfree(dmalloc(200));
+    }
+    DmallocStats after;
+    dmalloc_stats(&after);
+
+    for (size_t i = 0; i < count; i++) {
+        dfree(ptrs[i]);
+    }
+
+    size_t retrieved = (after.page_store_hits + after.page_store_misses) -
+                       (before.page_store_hits + before.page_store_misses);
+    if (retrieved != 0) {
+        printf("FAIL: %zu spans were retrieved crossing a bin boundary\n",
+               retrieved);
+        return false;
+    }
+
+    printf("PASS: Empty bin retention test\n");
+    return true;
+}
+
+static bool test_address_space() {
+    printf("Testing the reserved address space...\n");
+
+    // Enough blocks for many bins
+    enum { NUM_PTRS = 20000 };
+    static void *ptrs[NUM_PTRS];
+
+    // Nothing can be checked if the range is turned off or could not be
+    // reserved
+    void *probe = dmalloc(200);
+    bool reserved = address_space_contains(probe);
+    dfree(probe);
+    if (!reserved) {
+        printf("SKIP: No address space is reserved\n");
+        return true;
+    }
+
+    DmallocStats before;
+    dmalloc_stats(&before);
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        ptrs[i] = dmalloc(200);
+        if (!address_space_contains(ptrs[i])) {
+            printf("FAIL: Block %p is outside of the reserved range\n", ptrs[i]);
+            return false;
+        }
+    }
+    DmallocStats after;
+    dmalloc_stats(&after);
+
+    // Memory is committed in large steps so few calls are made to the os
+    size_t calls = (after.mmap_calls + after.mprotect_calls) -
+                   (before.mmap_calls + before.mprotect_calls);
+    if (calls > 4) {
+        printf("FAIL: %zu calls were made to map %d blocks\n", calls, NUM_PTRS);
+        return false;
+    }
+
+    // Spans that were given back keep their addresses so no new memory
+    // needs to be mapped to allocate the blocks again
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        dfree(ptrs[i]);
+    }
+    dmalloc_stats(&before);
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        ptrs[i] = dmalloc(200);
+    }
+    dmalloc_stats(&after);
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        dfree(ptrs[i]);
+    }
+
+    calls = (after.mmap_calls + after.mprotect_calls) -
+            (before.mmap_calls + before.mprotect_calls);
+    if (calls != 0) {
+        printf("FAIL: %zu calls were made to map blocks again\n", calls);
+        return false;
+    }
+
+    printf("PASS: Address space test\n");
+    return true;
+}
+
+static bool test_decay() {
+    printf("Testing decay of cached memory...\n");
+
+    // Fill the page store with spans and the huge cache with a mapping
+    enum { NUM_PTRS = 20000 };
+    static void *ptrs[NUM_PTRS];
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        ptrs[i] = dmalloc(200);
+    }
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        dfree(ptrs[i]);
+    }
+    dfree(dmalloc(1 << 20));
+
+    // Nothing has been cached for long yet
+    dmalloc_set_decay_time(60000);
+    if (dmalloc_maintenance() != 0) {
+        printf("FAIL: Recently cached memory was given back\n");
+        dmalloc_set_decay_time(DECAY_TIME);
+        return false;
+    }
+
+    DmallocStats before;
+    dmalloc_stats(&before);
+    dmalloc_set_decay_time(0);
+    size_t released = dmalloc_maintenance();
+    DmallocStats after;
+    dmalloc_stats(&after);
+    dmalloc_set_decay_time(DECAY_TIME);
+
+    if (released < (1 << 20)) {
+        printf("FAIL: Only %zu bytes were given back\n", released);
+        return false;
+    }
+    // empty bins kept by the thread are returned to the store as well, which
+    // can give back more memory if the store is full
+    if (before.mapped_bytes - after.mapped_bytes < released) {
+        printf("FAIL: %zu bytes were given back but mapped memory shrank by %zu\n",
+               released, before.mapped_bytes - after.mapped_bytes);
+        return false;
+    }
+    if (after.bins.live_regions >= before.bins.live_regions) {
+        printf("FAIL: The kept empty bins were not returned\n");
+        return false;
+    }
+
+    // Memory that was given back can be allocated again
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        ptrs[i] = dmalloc(200);
+        memset(ptrs[i], PATTERN_A, 200);
+    }
+    for (size_t i = 0; i < NUM_PTRS; i++) {
+        dfree(ptrs[i]);
+    }
+
+    if (!dmalloc_start_purge_thread()) {
+        printf("FAIL: The purge thread could not be started\n");
+        return false;
+    }
+    dmalloc_stop_purge_thread();
+
+    printf("PASS: Decay test\n");
+    return true;
+}
+
+static bool test_arena() {
+    printf("Testing arena allocation...\n");
+
+    DArena *arena = darena_create();
+    if (arena == NULL) {
+        printf("FAIL: Could not create an arena\n");
+        return false;
+    }
+
+    // Enough allocations to need several chunks, each aligned and distinct
+    bool passed = true;
+    void *first = NULL;
+    char *ptrs[5000];
+    for (size_t i = 0; i < 5000; i++) {
+        size_t size = 1 + (i * 37) % 200;
+        ptrs[i] = darena_alloc(arena, size);
+        if (ptrs[i] == NULL || (uintptr_t)ptrs[i] % ARENA_ALIGNMENT != 0) {
+            printf("FAIL: Arena allocation %zu is NULL or misaligned\n", i);
+            passed = false;
+            break;
+        }
+        if (i == 0) {
+            first = ptrs[i];
+        }
+        memset(ptrs[i], (int)(i & 0xFF), size);
+    }
+    for (size_t i = 0; passed && i < 5000; i++) {
+        if ((unsigned char)ptrs[i][0] != (i & 0xFF)) {
+            printf("FAIL: Arena allocation %zu was overwritten\n", i);
+            passed = false;
+        }
+    }
+
+    // Allocations larger than a chunk get pages of their own
+    size_t large_size = 1 << 20;
+    char *large = darena_alloc(arena, large_size);
+    if (large == NULL) {
+        printf("FAIL: Large arena allocation failed\n");
+        passed = false;
+    } else {
+        memset(large, PATTERN_A, large_size);
+    }
+
+    // After a reset the same memory is handed out again
+    darena_reset(arena);
+    if (darena_alloc(arena, 8) != first) {
+        printf("FAIL: Arena memory was not reused after a reset\n");
+        passed = false;
+    }
+    for (size_t i = 0; i < 5000; i++) {
+        memset(darena_alloc(arena, 64), PATTERN_B, 64);
+    }
+
+    darena_destroy(arena);
+
+    if (passed) {
+        printf("PASS: Arena allocation test\n");
+    }
+    return passed;
+}
+
 int main() {
     printf("Starting bin allocator tests...\n\n");
     
@@ -385,6 +1156,66 @@ int main() {
     
     all_passed &= test_mixed_size_stress();
     printf("\n");
+
+    all_passed &= test_size_classes();
+    printf("\n");
+
+    all_passed &= test_min_alignment();
+    printf("\n");
+
+    all_passed &= test_multi_page_bins();
+    printf("\n");
+
+    all_passed &= test_allocation_owner();
+    printf("\n");
+
+    all_passed &= test_huge_cache();
+    printf("\n");
+
+    all_passed &= test_huge_overflow();
+    printf("\n");
+
+    all_passed &= test_realloc_in_place();
+    printf("\n");
+
+    all_passed &= test_calloc();
+    printf("\n");
+
+    all_passed &= test_aligned_alloc();
+    printf("\n");
+
+    all_passed &= test_sized_free();
+    printf("\n");
+
+    all_passed &= test_batch();
+    printf("\n");
+
+    all_passed &= test_stats();
+    printf("\n");
+
+    all_passed &= test_partial_bins();
+    printf("\n");
+
+    all_passed &= test_empty_bin_retention();
+    printf("\n");
+
+    all_passed &= test_address_space();
+    printf("\n");
+
+    all_passed &= test_decay();
+    printf("\n");
+
+    all_passed &= test_arena();
+    printf("\n");
+
+    bitset_test();
+    printf("\n");
+
+    free_list_test();
+    printf("\n");
+
+    threads_test();
+    printf("\n");
     
     if (all_passed) {
         printf("🎉 ALL TESTS PASSED! Your bin allocator appears to be working correctly.\n");
@@ -0,0 +1,252 @@
+#include "test.h"
+#include "../src/allocator.h"
+#include "../src/bin.h"
+#include "../src/decay.h"
+#include "../src/page_store.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_THREADS 4
+#define ALLOCS_PER_THREAD 20000
+
+// Pointers allocated by one thread and freed by the next one
+static void *shared[NUM_THREADS][ALLOCS_PER_THREAD];
+
+static pthread_barrier_t barrier;
+
+static void *allocate_and_free_remotely(void *arg) {
+  size_t id = (size_t)arg;
+
+  // allocate memory that the next thread frees
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    size_t size = 8 + (i % 121);
+    shared[id][i] = dmalloc(size);
+    assert(shared[id][i] != NULL);
+    memset(shared[id][i], (int)id, size);
+  }
+
+  pthread_barrier_wait(&barrier);
+
+  // free the memory of the previous thread
+  size_t other = (id + NUM_THREADS - 1) % NUM_THREADS;
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    assert(*(unsigned char *)shared[other][i] == other);
+    dfree(shared[other][i]);
+  }
+
+  pthread_barrier_wait(&barrier);
+
+  // allocating again reclaims the memory freed by the other thread
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    shared[id][i] = dmalloc(16);
+    *(size_t *)shared[id][i] = id;
+  }
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    assert(*(size_t *)shared[id][i] == id);
+    dfree(shared[id][i]);
+  }
+
+  pthread_barrier_wait(&barrier);
+
+  // batches freed by another thread are queued for the owner in one go
+  assert(dmalloc_batch(24, ALLOCS_PER_THREAD, shared[id]) == ALLOCS_PER_THREAD);
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    memset(shared[id][i], (int)id, 24);
+  }
+
+  pthread_barrier_wait(&barrier);
+
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    assert(*(unsigned char *)shared[other][i] == other);
+  }
+  dfree_batch(shared[other], ALLOCS_PER_THREAD);
+
+  return NULL;
+}
+
+// Allocates memory and exits without freeing it
+static void *allocate_and_exit(void *arg) {
+  void **ptrs = arg;
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    ptrs[i] = dmalloc(32);
+    *(uintptr_t *)ptrs[i] = i;
+  }
+  return NULL;
+}
+
+#define HUGE_ROUNDS 300
+
+// Set once the threads that use huge allocations are done
+static atomic_bool huge_done;
+
+// Allocates and frees huge allocations of many sizes, which fill the cache of
+// mappings and give the pages of some of them back, while another thread
+// decays the cache
+static void *allocate_huge(void *arg) {
+  size_t id = (size_t)arg;
+
+  for (size_t round = 0; round < HUGE_ROUNDS; round++) {
+    void *ptrs[4];
+    size_t sizes[4];
+    for (size_t i = 0; i < 4; i++) {
+      sizes[i] = ((id + round + i) % 32 + 1) * 64 * 1024;
+      ptrs[i] = dmalloc(sizes[i]);
+      assert(ptrs[i] != NULL);
+      memset(ptrs[i], (int)(id + i + 1), sizes[i]);
+    }
+
+    void *small = dmalloc(64);
+    memset(small, (int)id, 64);
+
+    for (size_t i = 0; i < 4; i++) {
+      unsigned char *bytes = ptrs[i];
+      assert(bytes[0] == (unsigned char)(id + i + 1));
+      assert(bytes[sizes[i] - 1] == (unsigned char)(id + i + 1));
+      dfree(ptrs[i]);
+    }
+    dfree(small);
+  }
+
+  return NULL;
+}
+
+// Gives back everything that is cached until the other threads are done
+static void *run_maintenance(void *arg) {
+  (void)arg;
+  while (!atomic_load(&huge_done)) {
+    dmalloc_maintenance();
+  }
+  return NULL;
+}
+
+// The number of bins an owner lays out to be emptied by remote frees: the
+// kept empty bin, EMPTY_BIN_RETIRES bins in front of it in the list and one
+// behind it
+#define REMOTE_EMPTY_BINS (EMPTY_BIN_RETIRES + 2)
+
+// Frees the pointers that are not NULL
+static void *free_remotely(void *arg) {
+  void **ptrs = arg;
+  for (size_t i = 0; i < NUM_THREADS * ALLOCS_PER_THREAD; i++) {
+    if (ptrs[i] != NULL) {
+      dfree(ptrs[i]);
+    }
+  }
+  return NULL;
+}
+
+// Has another thread empty more bins than EMPTY_BIN_RETIRES, which are then
+// all collected in one go. The kept empty bin is released during that
+// collection while bins after it in the list still have to be looked at
+static void *empty_bins_remotely(void *arg) {
+  (void)arg;
+  void **ptrs = &shared[0][0];
+  void *bins[REMOTE_EMPTY_BINS];
+  size_t firsts[REMOTE_EMPTY_BINS];
+
+  // allocate until the last bin holds a single block, every other one is full
+  size_t count = 0;
+  size_t num_bins = 0;
+  while (num_bins < REMOTE_EMPTY_BINS) {
+    assert(count < NUM_THREADS * ALLOCS_PER_THREAD);
+    ptrs[count] = dmalloc(200);
+    void *bin = allocated_by_bin(ptrs[count]);
+    if (num_bins == 0 || bin != bins[num_bins - 1]) {
+      bins[num_bins] = bin;
+      firsts[num_bins++] = count;
+    }
+    count++;
+  }
+  for (size_t i = count; i < NUM_THREADS * ALLOCS_PER_THREAD; i++) {
+    ptrs[i] = NULL;
+  }
+
+  // the first bin becomes the kept empty bin
+  for (size_t i = firsts[0]; i < firsts[1]; i++) {
+    dfree(ptrs[i]);
+    ptrs[i] = NULL;
+  }
+
+  // freeing a block of the other full bins moves them in front of it
+  for (size_t b = 1; b < REMOTE_EMPTY_BINS - 1; b++) {
+    dfree(ptrs[firsts[b]]);
+    ptrs[firsts[b]] = NULL;
+  }
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, free_remotely, ptrs);
+  pthread_join(thread, NULL);
+
+  // a size class without bins collects the remote frees of every class
+  void *ptr = dmalloc(16);
+
+  // every bin was empty so all of them, including the last one behind the
+  // kept bin, are returned to the store
+  for (size_t b = 0; b < REMOTE_EMPTY_BINS; b++) {
+    assert(allocated_by_bin(bins[b]) == NULL);
+  }
+
+  dfree(ptr);
+  return NULL;
+}
+
+void threads_test() {
+  printf("Testing allocation across threads...\n");
+
+  pthread_t threads[NUM_THREADS];
+  pthread_barrier_init(&barrier, NULL, NUM_THREADS);
+
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, allocate_and_free_remotely, (void *)i);
+  }
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  pthread_barrier_destroy(&barrier);
+
+  // memory of an exited thread can still be freed and its bins are reused
+  pthread_t thread;
+  pthread_create(&thread, NULL, allocate_and_exit, shared[0]);
+  pthread_join(thread, NULL);
+
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    assert(*(uintptr_t *)shared[0][i] == i);
+    dfree(shared[0][i]);
+  }
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    shared[0][i] = dmalloc(32);
+  }
+  for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+    dfree(shared[0][i]);
+  }
+
+  // spans are given back to the os as soon as they are stored so a bin that
+  // is looked at after it was released reads as zero
+  dmalloc_set_store_size(0);
+  pthread_create(&thread, NULL, empty_bins_remotely, NULL);
+  pthread_join(thread, NULL);
+  dmalloc_set_store_size(STORE_SIZE);
+
+  // cached mappings and spans are given back while other threads store and
+  // take them
+  dmalloc_set_decay_time(0);
+  atomic_store(&huge_done, false);
+  pthread_t maintenance;
+  pthread_create(&maintenance, NULL, run_maintenance, NULL);
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, allocate_huge, (void *)i);
+  }
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  atomic_store(&huge_done, true);
+  pthread_join(maintenance, NULL);
+  dmalloc_set_decay_time(DECAY_TIME);
+
+  printf("PASS: Threads test\n");
+}